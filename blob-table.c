@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "blob-table.h"
+
+/* main table and one per workload thread */
+#define MAX_TABLES 1025
+
+static struct blob_table *tables[MAX_TABLES];
+static int tables_count;
+static pthread_mutex_t tables_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static
+void *map_array(size_t len)
+{
+	void *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (p == MAP_FAILED) {
+		perror("mmap");
+		abort();
+	}
+	return p;
+}
+
+void blob_table_init(struct blob_table *t, int count)
+{
+	t->count = count;
+	t->live = 0;
+	t->high = 0;
+	t->ptrs = map_array((size_t)count * sizeof(*t->ptrs));
+	t->sizes = map_array((size_t)count * sizeof(*t->sizes));
+	t->order = map_array((size_t)count * sizeof(*t->order));
+	t->pos = map_array((size_t)count * sizeof(*t->pos));
+
+	pthread_mutex_lock(&tables_lock);
+	if (tables_count == MAX_TABLES) {
+		fprintf(stderr, "too many blob tables\n");
+		abort();
+	}
+	tables[tables_count++] = t;
+	pthread_mutex_unlock(&tables_lock);
+}
+
+void blob_table_destroy(struct blob_table *t)
+{
+	munmap(t->ptrs, (size_t)t->count * sizeof(*t->ptrs));
+	munmap(t->sizes, (size_t)t->count * sizeof(*t->sizes));
+	munmap(t->order, (size_t)t->count * sizeof(*t->order));
+	munmap(t->pos, (size_t)t->count * sizeof(*t->pos));
+	t->count = 0;
+
+	pthread_mutex_lock(&tables_lock);
+	for (int k = 0; k < tables_count; k++) {
+		if (tables[k] == t) {
+			tables[k] = tables[--tables_count];
+			break;
+		}
+	}
+	pthread_mutex_unlock(&tables_lock);
+}
+
+void blob_table_clear(struct blob_table *t)
+{
+	/* pages of private anonymous mapping read back as zeros after
+	 * that */
+	madvise(t->ptrs, (size_t)t->high * sizeof(*t->ptrs), MADV_DONTNEED);
+	madvise(t->sizes, (size_t)t->high * sizeof(*t->sizes), MADV_DONTNEED);
+	madvise(t->order, (size_t)t->high * sizeof(*t->order), MADV_DONTNEED);
+	madvise(t->pos, (size_t)t->high * sizeof(*t->pos), MADV_DONTNEED);
+	t->live = 0;
+	t->high = 0;
+}
+
+static
+size_t array_resident(size_t bytes, size_t page)
+{
+	return (bytes + page - 1) & ~(page - 1);
+}
+
+size_t blob_tables_resident(void)
+{
+	static size_t page;
+	size_t rv = 0;
+	if (!page) {
+		page = sysconf(_SC_PAGESIZE);
+	}
+	pthread_mutex_lock(&tables_lock);
+	for (int k = 0; k < tables_count; k++) {
+		/* owner may be adding slots, so this is a snapshot */
+		size_t high = __atomic_load_n(&tables[k]->high, __ATOMIC_RELAXED);
+		rv += array_resident(high * sizeof(*tables[k]->ptrs), page)
+			+ array_resident(high * sizeof(*tables[k]->sizes), page)
+			+ array_resident(high * sizeof(*tables[k]->order), page)
+			+ array_resident(high * sizeof(*tables[k]->pos), page);
+	}
+	pthread_mutex_unlock(&tables_lock);
+	return rv;
+}
@@ -0,0 +1,100 @@
+#ifndef BLOB_TABLE_H
+#define BLOB_TABLE_H
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Table of blobs workloads keep. Struct of arrays: pointer and 32 bit
+ * size per slot, plus order[], permutation of slots where first live
+ * entries are live slots and the rest are free ones, and pos[], it's
+ * inverse. So adding and removing blobs, walking live ones and
+ * picking random live one are all O(1) per blob, regardless of how
+ * sparse table is.
+ *
+ * Arrays are mapped with MAP_NORESERVE and slots are taken in order
+ * (up to high), so only pages of slots ever used are faulted in.
+ * Slot is live iff it's ptrs entry is not NULL.
+ *
+ * Tables are harness' own memory, but RSS-based footprints (mini, dl,
+ * je, dlms) would count it. So all tables are tracked and
+ * rss_allocated() subtracts blob_tables_resident().
+ */
+struct blob_table {
+	void **ptrs;
+	uint32_t *sizes;
+	int *order;
+	int *pos;
+	int count;
+	int live;
+	/* slots at and above high were never used, and their order
+	 * and pos entries are not initialized */
+	int high;
+};
+
+extern void blob_table_init(struct blob_table *t, int count);
+extern void blob_table_destroy(struct blob_table *t);
+/* forgets all blobs (without freeing them) and gives pages back */
+extern void blob_table_clear(struct blob_table *t);
+/* bytes of pages below high of all tables, i.e. what they add to
+ * RSS. May be called from any thread */
+extern size_t blob_tables_resident(void);
+
+/* i-th live slot */
+static inline
+int blob_table_live_slot(const struct blob_table *t, int i)
+{
+	return t->order[i];
+}
+
+/* r is random number, i.e. from random(). Table must not be empty */
+static inline
+int blob_table_sample(const struct blob_table *t, uint32_t r)
+{
+	return t->order[r % t->live];
+}
+
+static inline
+void blob_table_swap(struct blob_table *t, int i, int j)
+{
+	int a = t->order[i];
+	int b = t->order[j];
+	t->order[i] = b;
+	t->pos[b] = i;
+	t->order[j] = a;
+	t->pos[a] = j;
+}
+
+/* puts blob into given free slot */
+static inline
+void blob_table_add_at(struct blob_table *t, int slot, void *p, uint32_t size)
+{
+	while (t->high <= slot) {
+		t->order[t->high] = t->high;
+		t->pos[t->high] = t->high;
+		t->high++;
+	}
+	blob_table_swap(t, t->pos[slot], t->live);
+	t->live++;
+	t->ptrs[slot] = p;
+	t->sizes[slot] = size;
+}
+
+/* free slot add would use, or -1 if table is full */
+static inline
+int blob_table_free_slot(const struct blob_table *t)
+{
+	if (t->live < t->high) {
+		return t->order[t->live];
+	}
+	return t->high < t->count ? t->high : -1;
+}
+
+static inline
+void blob_table_remove(struct blob_table *t, int slot)
+{
+	t->live--;
+	blob_table_swap(t, t->pos[slot], t->live);
+	t->ptrs[slot] = 0;
+}
+
+#endif
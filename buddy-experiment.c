@@ -7,7 +7,9 @@
 #include <assert.h>
 #include <sys/time.h>
 #include <sys/uio.h>
+#include <sys/mman.h>
 #include "common.h"
+#include "prefault.h"
 
 /*
  * Block starts with following struct.
@@ -49,20 +51,42 @@ size_t buddy_get_total_allocated_size(void)
 
 void validate_all_chains(void);
 
+/* max order blocks are mmap-ed directly, naturally aligned. Address
+ * range is reserved twice as big, and then block is mapped over it's
+ * aligned part, so that only block itself is ever populated */
+static
+struct block *map_max_order_block(void)
+{
+	size_t size = (size_t)1 << MAX_ORDER;
+	char *p = mmap(NULL, 2 * size, PROT_NONE,
+		       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	char *aligned;
+	if (p == MAP_FAILED) {
+		perror("mmap");
+		abort();
+	}
+	aligned = (char *)(((uintptr_t)p + size - 1) & ~(size - 1));
+	if (aligned != p) {
+		munmap(p, aligned - p);
+	}
+	munmap(aligned + size, p + size - aligned);
+	if (prefault_mmap(aligned, size, MAP_FIXED) == MAP_FAILED) {
+		perror("mmap");
+		abort();
+	}
+	return (struct block *)aligned;
+}
+
 static
 void *allocate_max_order_block(void)
 {
 	validate_all_chains();
 
-	struct block *rv;
-	int error;
-	error = posix_memalign((void **)&rv, 1 << MAX_ORDER, 1 << MAX_ORDER);
-	if (error) {
-		errno = error;
-		perror("posix_memalign");
-		abort();
+	struct block *rv = map_max_order_block();
+	/* poisoning was always what faulted buddy's pages in */
+	if (prefault_policy == PREFAULT_TOUCH) {
+		memset(rv, 0xcc, 1 << MAX_ORDER);
 	}
-	memset(rv, 0xcc, 1 << MAX_ORDER);
 	rv->next = USED_MARKER;
 	rv->pprev = 0;
 	max_order_blocks_alloced++;
@@ -161,6 +185,30 @@ void free_block(void *ptr, int order)
 	enqueue_free(p, order);
 }
 
+/* gives fully coalesced max order blocks back */
+size_t buddy_release_free_memory(size_t budget)
+{
+	size_t released = 0;
+	struct block *p;
+	while (released < budget && (p = blocks_orders[MAX_ORDER])) {
+		dequeue_free(p);
+		munmap(p, (size_t)1 << MAX_ORDER);
+		max_order_blocks_alloced--;
+		released += (size_t)1 << MAX_ORDER;
+	}
+	return released;
+}
+
+static
+void buddy_iterate_free(void *data, void (*cb)(size_t size, size_t count, void *data))
+{
+	for (int order = MIN_ORDER; order <= MAX_ORDER; order++) {
+		if (per_order_counts[order]) {
+			cb((size_t)1 << order, per_order_counts[order], data);
+		}
+	}
+}
+
 #define CHUNKS_COUNT 5
 
 /*
@@ -334,5 +382,7 @@ allocation_functions buddy_fns = {
 	.name = "buddy",
 	.alloc = (void *(*)(size_t))buddy_allocate_blob,
 	.free = (void (*)(void *, size_t))buddy_free_blob,
-	.get_total_allocated_size = buddy_get_total_allocated_size
+	.get_total_allocated_size = buddy_get_total_allocated_size,
+	.release_free_memory = buddy_release_free_memory,
+	.iterate_free = buddy_iterate_free
 };
@@ -37,6 +37,11 @@ static void chunky_free_blob(struct chunked_blob *, size_t);
 static size_t chunky_get_total_allocated_size(void);
 static void chunky_iterate_chunks(void *_blob, size_t s, void *data,
 				  void (*cb)(void *p, size_t s, void *data));
+static bool chunky_reset(void);
+static void chunky_print_details(FILE *f);
+static size_t chunky_release_free_memory(size_t budget);
+static void chunky_iterate_free(void *data,
+				void (*cb)(size_t size, size_t count, void *data));
 
 
 allocation_functions chunky_fns = {
@@ -44,10 +49,15 @@ allocation_functions chunky_fns = {
 	.alloc = (void *(*)(size_t))chunky_allocate_blob,
 	.free = (void (*)(void *, size_t))chunky_free_blob,
 	.get_total_allocated_size = chunky_get_total_allocated_size,
-	.iterate_chunks = chunky_iterate_chunks
+	.iterate_chunks = chunky_iterate_chunks,
+	.reset = chunky_reset,
+	.print_details = chunky_print_details,
+	.release_free_memory = chunky_release_free_memory,
+	.iterate_free = chunky_iterate_free
 };
 
 allocation_functions *chunky_slave_fns;
+bool chunky_batch;
 
 /* We need to find at most CHUNKS_COUNT powers of two that cover size
  * + all required metadata (chunked_blob, block headers) with minimal
@@ -131,6 +141,49 @@ void chunky_xfree(void *p, size_t size)
 	chunky_slave_fns->free(p, size);
 }
 
+/* all chunks in single slave call, if slave supports that */
+static
+struct chunked_blob *chunky_allocate_blob_batch(size_t size, int orders[CHUNKS_COUNT])
+{
+	size_t subsizes[CHUNKS_COUNT];
+	void *chunks[CHUNKS_COUNT];
+	struct chunked_blob *blob;
+	unsigned allocated = 0;
+	int i;
+	int n;
+
+	for (n = 0; n < CHUNKS_COUNT && orders[n] >= 0; n++) {
+		subsizes[n] = 1U << orders[n];
+		allocated += subsizes[n];
+	}
+	assert(allocated > size);
+
+	if (!chunky_slave_fns->alloc_batch(n, subsizes, chunks)) {
+		abort();
+	}
+	blob = chunks[0];
+	for (i = 1; i < n; i++) {
+		blob->other_chunks[i-1] = chunks[i];
+	}
+	return blob;
+}
+
+static
+void chunky_free_blob_batch(struct chunked_blob *blob, int orders[CHUNKS_COUNT])
+{
+	size_t subsizes[CHUNKS_COUNT];
+	void *chunks[CHUNKS_COUNT];
+	int n;
+
+	chunks[0] = blob;
+	subsizes[0] = 1U << orders[0];
+	for (n = 1; n < CHUNKS_COUNT && orders[n] >= 0; n++) {
+		chunks[n] = blob->other_chunks[n-1];
+		subsizes[n] = 1U << orders[n];
+	}
+	chunky_slave_fns->free_batch(chunks, subsizes, n);
+}
+
 static
 struct chunked_blob *chunky_allocate_blob(size_t size)
 {
@@ -142,6 +195,10 @@ struct chunked_blob *chunky_allocate_blob(size_t size)
 
 	value_size_to_block_sizes(size, orders);
 
+	if (chunky_batch && chunky_slave_fns->alloc_batch) {
+		return chunky_allocate_blob_batch(size, orders);
+	}
+
 	blob = chunky_xmalloc(subsize = (1U << (orders[0])));
 	allocated = subsize;
 	/* blob->size = size; */
@@ -164,6 +221,11 @@ void chunky_free_blob(struct chunked_blob *blob, size_t size)
 	int orders[CHUNKS_COUNT];
 	value_size_to_block_sizes(size, orders);
 
+	if (chunky_batch && chunky_slave_fns->free_batch) {
+		chunky_free_blob_batch(blob, orders);
+		return;
+	}
+
 	for (i = CHUNKS_COUNT-1; i > 0; i--) {
 		if (orders[i] < 0)
 			continue;
@@ -178,6 +240,38 @@ size_t chunky_get_total_allocated_size(void)
 	return chunky_slave_fns->get_total_allocated_size();
 }
 
+/* all our memory comes from slave, so we can reset if it can */
+static
+bool chunky_reset(void)
+{
+	return chunky_slave_fns->reset && chunky_slave_fns->reset();
+}
+
+static
+size_t chunky_release_free_memory(size_t budget)
+{
+	if (!chunky_slave_fns->release_free_memory) {
+		return 0;
+	}
+	return chunky_slave_fns->release_free_memory(budget);
+}
+
+static
+void chunky_iterate_free(void *data, void (*cb)(size_t size, size_t count, void *data))
+{
+	if (chunky_slave_fns->iterate_free) {
+		chunky_slave_fns->iterate_free(data, cb);
+	}
+}
+
+static
+void chunky_print_details(FILE *f)
+{
+	if (chunky_slave_fns->print_details) {
+		chunky_slave_fns->print_details(f);
+	}
+}
+
 static
 void chunky_iterate_chunks(void *_blob, size_t size, void *data,
 			   void (*cb)(void *p, size_t s, void *data))
@@ -1,25 +1,70 @@
 #ifndef COMMON_H
 #define COMMON_H
 #include <sys/types.h>
+#include <stdio.h>
+#include <stdbool.h>
 
 typedef struct {
 	const char *name;
+	/* alloc and free may be called from multiple threads at once */
+	bool thread_safe;
 	void *(*alloc)(size_t);
 	void (*free)(void *, size_t);
 	size_t (*get_total_allocated_size)(void);
 	void (*iterate_chunks)(void *p, size_t size, void *data,
 			       void (*cb)(void *p, size_t s, void *data));
+	/* optional. Frees all allocations at once keeping memory
+	 * around for reuse. Returns false if it cannot do that. */
+	bool (*reset)(void);
+	/* optional. Moves at most budget bytes of live allocations
+	 * to release memory, telling caller about every move via
+	 * relocate. Returns bytes released. */
+	size_t (*compact)(size_t budget,
+			  void (*relocate)(void *old_p, void *new_p, void *data),
+			  void *data);
+	/* optional. Allocates n chunks of given sizes at once
+	 * (i.e. contiguously). Returns false on failure */
+	bool (*alloc_batch)(size_t n, size_t *sizes, void **chunks);
+	/* optional. Frees n chunks at once. Chunks may come from
+	 * alloc or alloc_batch */
+	void (*free_batch)(void **chunks, size_t *sizes, size_t n);
+	/* optional. Prints allocator specific stats lines */
+	void (*print_details)(FILE *f);
+	/* optional. Walks whole heap calling cb for every allocated
+	 * chunk */
+	void (*iterate_heap)(void *data, void (*cb)(void *p, size_t s, void *data));
+	/* optional. Gives roughly budget bytes of free memory back
+	 * to OS. May release more if allocator's unit of release is
+	 * bigger. Returns bytes released */
+	size_t (*release_free_memory)(size_t budget);
+	/* optional. Calls cb with size and count of free spans of
+	 * that size, for all free memory of heap. May walk whole heap,
+	 * so it's only for occasional samples */
+	void (*iterate_free)(void *data, void (*cb)(size_t size, size_t count, void *data));
 } allocation_functions;
 
 extern allocation_functions *main_fns;
 extern allocation_functions *chunky_slave_fns;
 extern allocation_functions chunky_fns;
+/* chunky takes blob's chunks with one alloc_batch (and gives them
+ * back with one free_batch) when slave has them. Off by default,
+ * since with dl that makes chunks contiguous, i.e. it's a different
+ * layout than plain chunky */
+extern bool chunky_batch;
 extern allocation_functions jemalloc_fns;
 extern allocation_functions mini_fns;
 extern allocation_functions buddy_fns;
 extern allocation_functions dl_fns;
+extern allocation_functions dl_mspace_fns;
+
+extern size_t mini_max_chunk_size;
+extern const char *mini_persist_path;
+/* attaches heap in mini_persist_path right away (normally it is
+ * attached by first alloc). Returns slot for pointer to caller's own
+ * state that is kept in heap along with it, or NULL without
+ * mini_persist_path. Heap is closed by exit() */
+extern void **mini_attach_persistent(bool *reattached);
 
-void *touch_pages(void *p, size_t size);
 size_t rss_allocated();
 
 #endif
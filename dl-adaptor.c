@@ -1,17 +1,40 @@
+#include <stdio.h>
+#include <stdlib.h>
 #include "common.h"
+#include "prefault.h"
 
 extern void *dlmalloc(size_t size);
 extern void dlfree(void *);
+extern void **dlindependent_comalloc(size_t n, size_t *sizes, void **chunks);
+extern size_t dlbulk_free(void **chunks, size_t n);
+extern size_t dlmalloc_footprint(void);
+extern int dlmalloc_trim(size_t pad);
+extern void dlmalloc_inspect_all(void (*handler)(void *start, void *end,
+						 size_t used_bytes, void *arg),
+				 void *arg);
 
-__attribute__((used))
-static size_t dl_total_allocated;
+/* same layout as dlmalloc's struct mallinfo (size_t fields), which
+ * is different from glibc's one */
+struct dl_mallinfo {
+	size_t arena;
+	size_t ordblks;
+	size_t smblks;
+	size_t hblks;
+	size_t hblkhd;
+	size_t usmblks;
+	size_t fsmblks;
+	size_t uordblks;
+	size_t fordblks;
+	size_t keepcost;
+};
+
+extern struct dl_mallinfo dlmallinfo(void);
 
 static
 void *dl_alloc(size_t size)
 {
 	void *rv = dlmalloc(size);
-	touch_pages(rv, size);
-	dl_total_allocated += size;
+	prefault_alloc(rv, size);
 	return rv;
 }
 
@@ -19,19 +42,122 @@ static
 void dl_free(void *p, size_t size)
 {
 	dlfree(p);
-	dl_total_allocated -= size;
 }
 
+/* carves all chunks out of single dlmalloc chunk, so we do single
+ * bin search and chunks are adjacent */
+static
+bool dl_alloc_batch(size_t n, size_t *sizes, void **chunks)
+{
+	size_t i;
+	if (!dlindependent_comalloc(n, sizes, chunks)) {
+		return false;
+	}
+	for (i = 0; i < n; i++) {
+		prefault_alloc(chunks[i], sizes[i]);
+	}
+	return true;
+}
+
+static
+void dl_free_batch(void **chunks, size_t *sizes, size_t n)
+{
+	if (dlbulk_free(chunks, n)) {
+		fprintf(stderr, "dlbulk_free failed\n");
+		abort();
+	}
+}
+
+/* RSS like every other allocator, so that waste stays comparable
+ * across them. Exact footprint is among dl_print_details */
 static
 size_t dl_get_total_allocated_size(void)
 {
-	/* return dl_total_allocated; */
 	return rss_allocated();
 }
 
+/* dlmalloc can only give back top of heap and unused mmapped
+ * segments, so budget is ignored */
+static
+size_t dl_release_free_memory(size_t budget)
+{
+	size_t before = dlmalloc_footprint();
+	dlmalloc_trim(0);
+	return before - dlmalloc_footprint();
+}
+
+/* dlmallinfo walks whole heap, so it's only used for occasional
+ * stats */
+static
+void dl_print_details(FILE *f)
+{
+	struct dl_mallinfo mi = dlmallinfo();
+	fprintf(f, "dl footprint: %zu\n"
+		"dl in use: %zu\n"
+		"dl free: %zu (%zu chunks)\n"
+		"dl releasable top: %zu\n"
+		"dl mmapped: %zu\n",
+		dlmalloc_footprint(),
+		mi.uordblks,
+		mi.fordblks, mi.ordblks,
+		mi.keepcost,
+		mi.hblkhd);
+}
+
+struct inspect_state {
+	void *data;
+	void (*cb)(void *p, size_t s, void *data);
+};
+
+static
+void dl_inspect_handler(void *start, void *end, size_t used_bytes, void *arg)
+{
+	struct inspect_state *st = arg;
+	if (used_bytes) {
+		st->cb(start, used_bytes, st->data);
+	}
+}
+
+/* NOTE: directly mmapped chunks are not visited by
+ * dlmalloc_inspect_all */
+static
+void dl_iterate_heap(void *data, void (*cb)(void *p, size_t s, void *data))
+{
+	struct inspect_state st = {.data = data, .cb = cb};
+	dlmalloc_inspect_all(dl_inspect_handler, &st);
+}
+
+struct free_state {
+	void *data;
+	void (*cb)(size_t size, size_t count, void *data);
+};
+
+static
+void dl_free_handler(void *start, void *end, size_t used_bytes, void *arg)
+{
+	struct free_state *st = arg;
+	if (!used_bytes) {
+		st->cb((char *)end - (char *)start, 1, st->data);
+	}
+}
+
+static
+void dl_iterate_free(void *data, void (*cb)(size_t size, size_t count, void *data))
+{
+	struct free_state st = {.data = data, .cb = cb};
+	dlmalloc_inspect_all(dl_free_handler, &st);
+}
+
 allocation_functions dl_fns = {
 	.name = "dl",
+	.thread_safe = true,
 	.alloc = dl_alloc,
 	.free = dl_free,
-	.get_total_allocated_size = dl_get_total_allocated_size
+	.get_total_allocated_size = dl_get_total_allocated_size,
+	.alloc_batch = dl_alloc_batch,
+	.free_batch = dl_free_batch,
+	.print_details = dl_print_details,
+	.iterate_heap = dl_iterate_heap,
+	.release_free_memory = dl_release_free_memory,
+	.iterate_free = dl_iterate_free
 };
@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "common.h"
+#include "prefault.h"
+
+/*
+ * dlmalloc with heap (mspace) per thread. Every thread allocates
+ * from it's own mspace, so threads don't contend unless they free
+ * each other's memory. dl-mspace.o is built with FOOTERS, so every
+ * chunk knows it's mspace and mspace_free routes cross-thread frees
+ * back to owning mspace (taking it's lock).
+ */
+
+typedef void *mspace;
+
+extern mspace create_mspace(size_t capacity, int locked);
+extern void *mspace_malloc(mspace msp, size_t bytes);
+extern void mspace_free(mspace msp, void *mem);
+extern int mspace_trim(mspace msp, size_t pad);
+extern size_t mspace_footprint(mspace msp);
+
+static __thread mspace thread_msp;
+
+#define MAX_MSPACES 1024
+
+/* all mspaces ever created, so that they can be trimmed */
+static mspace all_msps[MAX_MSPACES];
+static int all_msps_count;
+static pthread_mutex_t all_msps_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static
+mspace get_thread_msp(void)
+{
+	if (!thread_msp) {
+		thread_msp = create_mspace(0, 1);
+		if (!thread_msp) {
+			fprintf(stderr, "create_mspace failed\n");
+			abort();
+		}
+		pthread_mutex_lock(&all_msps_lock);
+		if (all_msps_count >= MAX_MSPACES) {
+			fprintf(stderr, "too many mspaces\n");
+			abort();
+		}
+		all_msps[all_msps_count++] = thread_msp;
+		pthread_mutex_unlock(&all_msps_lock);
+	}
+	return thread_msp;
+}
+
+static
+void *dlms_alloc(size_t size)
+{
+	return prefault_alloc(mspace_malloc(get_thread_msp(), size), size);
+}
+
+static
+void dlms_free(void *p, size_t size)
+{
+	/* mspace argument is ignored with FOOTERS */
+	mspace_free(thread_msp, p);
+}
+
+static
+size_t dlms_get_total_allocated_size(void)
+{
+	return rss_allocated();
+}
+
+/* like for dl, budget is ignored */
+static
+size_t dlms_release_free_memory(size_t budget)
+{
+	size_t released = 0;
+	int i;
+	pthread_mutex_lock(&all_msps_lock);
+	for (i = 0; i < all_msps_count; i++) {
+		size_t before = mspace_footprint(all_msps[i]);
+		mspace_trim(all_msps[i], 0);
+		released += before - mspace_footprint(all_msps[i]);
+	}
+	pthread_mutex_unlock(&all_msps_lock);
+	return released;
+}
+
+allocation_functions dl_mspace_fns = {
+	.name = "dl_mspace",
+	.thread_safe = true,
+	.alloc = dlms_alloc,
+	.free = dlms_free,
+	.get_total_allocated_size = dlms_get_total_allocated_size,
+	.release_free_memory = dlms_release_free_memory
+};
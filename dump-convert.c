@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "trace.h"
+
+/*
+ * Converts simple_dump ({uint32 key, uint32 len} records) into v2
+ * trace. Records for keys that are already live become reallocs.
+ */
+
+typedef struct {
+	uint32_t sec;
+	uint32_t len;
+} sim_evt_t;
+
+static uint64_t *live;
+static size_t live_words;
+
+static
+bool test_and_set_live(uint32_t key)
+{
+	size_t word = key / 64;
+	uint64_t bit = (uint64_t)1 << (key % 64);
+	bool rv;
+	if (word >= live_words) {
+		size_t new_words = live_words ? live_words : 1024;
+		while (new_words <= word) {
+			new_words *= 2;
+		}
+		live = realloc(live, new_words * sizeof(*live));
+		if (!live) {
+			perror("realloc");
+			abort();
+		}
+		memset(live + live_words, 0, (new_words - live_words) * sizeof(*live));
+		live_words = new_words;
+	}
+	rv = (live[word] & bit) != 0;
+	live[word] |= bit;
+	return rv;
+}
+
+int main(int argc, char **argv)
+{
+	struct trace_writer *w;
+	struct trace_event e = {0};
+	sim_evt_t evt;
+	unsigned long allocs = 0, reallocs = 0;
+	struct stat in_st, out_st;
+	FILE *f;
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s simple_dump trace\n", argv[0]);
+		return 1;
+	}
+
+	f = fopen(argv[1], "rb");
+	if (!f) {
+		perror("fopen");
+		return 1;
+	}
+	w = trace_writer_open(argv[2], 0);
+	while (fread(&evt, sizeof(evt), 1, f) == 1) {
+		e.key = evt.sec;
+		e.len = evt.len;
+		if (test_and_set_live(evt.sec)) {
+			e.type = TRACE_REALLOC;
+			reallocs++;
+		} else {
+			e.type = TRACE_ALLOC;
+			allocs++;
+		}
+		trace_write(w, &e);
+	}
+	if (ferror(f)) {
+		perror("fread");
+		return 1;
+	}
+	fclose(f);
+	trace_writer_close(w);
+
+	if (stat(argv[1], &in_st) || stat(argv[2], &out_st)) {
+		perror("stat");
+		return 1;
+	}
+	printf("%lu allocs, %lu reallocs\n%lld -> %lld bytes (%.1f%%)\n",
+	       allocs, reallocs, (long long)in_st.st_size, (long long)out_st.st_size,
+	       in_st.st_size ? out_st.st_size * 100.0 / in_st.st_size : 0);
+	return 0;
+}
@@ -0,0 +1,382 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include "frag-log.h"
+
+/*
+ * Reads fragmentation log (see frag-log.h) and prints waste curves.
+ * Runs with same allocator, minimal_size and size_range are
+ * aggregated, i.e. repeated runs are averaged. Every curve is cut
+ * into given number of equal ops intervals.
+ *
+ * Summary tells steady state waste (mean over second half of ops),
+ * ops after which waste stayed within 1 percentage point of it (n/a
+ * if it didn't even at the end), and
+ * creep: slope of waste over second half, in percentage points per
+ * million ops.
+ */
+
+#define MAX_GROUPS 256
+#define MAX_RUNS 4096
+
+struct point {
+	uint64_t ops;
+	uint64_t time_ns;
+	uint64_t footprint;
+	uint64_t live_bytes;
+	uint64_t rss;
+};
+
+struct group {
+	char allocator[64];
+	int minimal_size;
+	int size_range;
+	int runs;
+	struct point *points;
+	size_t count;
+	size_t capacity;
+	/* last sample with free spans */
+	struct frag_log_sample spans;
+	bool has_spans;
+};
+
+struct run {
+	uint32_t id;
+	int group;
+};
+
+static struct group groups[MAX_GROUPS];
+static int groups_count;
+static struct run runs[MAX_RUNS];
+static int runs_count;
+
+static
+void *xrealloc(void *p, size_t size)
+{
+	p = realloc(p, size);
+	if (!p) {
+		perror("realloc");
+		abort();
+	}
+	return p;
+}
+
+static
+int find_group(const struct frag_log_run *r)
+{
+	int k;
+	for (k = 0; k < groups_count; k++) {
+		struct group *g = &groups[k];
+		if (strncmp(g->allocator, r->allocator, sizeof(r->allocator)) == 0
+		    && g->minimal_size == r->minimal_size && g->size_range == r->size_range) {
+			return k;
+		}
+	}
+	if (groups_count == MAX_GROUPS) {
+		fprintf(stderr, "too many configurations\n");
+		exit(1);
+	}
+	memcpy(groups[k].allocator, r->allocator, sizeof(r->allocator));
+	groups[k].allocator[sizeof(groups[k].allocator) - 1] = 0;
+	groups[k].minimal_size = r->minimal_size;
+	groups[k].size_range = r->size_range;
+	return groups_count++;
+}
+
+static
+void add_run(const struct frag_log_run *r)
+{
+	int k;
+	/* pids get reused, later run wins */
+	for (k = 0; k < runs_count && runs[k].id != r->run; k++)
+		;
+	if (k == runs_count) {
+		if (runs_count == MAX_RUNS) {
+			fprintf(stderr, "too many runs\n");
+			exit(1);
+		}
+		runs_count++;
+	}
+	runs[k].id = r->run;
+	runs[k].group = find_group(r);
+	groups[runs[k].group].runs++;
+}
+
+static
+void add_sample(const struct frag_log_sample *s)
+{
+	struct group *g;
+	int k;
+	for (k = 0; k < runs_count && runs[k].id != s->run; k++)
+		;
+	if (k == runs_count) {
+		fprintf(stderr, "sample of unknown run %u\n", s->run);
+		return;
+	}
+	g = &groups[runs[k].group];
+	if (g->count == g->capacity) {
+		g->capacity = g->capacity ? g->capacity * 2 : 1024;
+		g->points = xrealloc(g->points, g->capacity * sizeof(*g->points));
+	}
+	g->points[g->count++] = (struct point){
+		.ops = s->ops,
+		.time_ns = s->time_ns,
+		.footprint = s->footprint,
+		.live_bytes = s->live_bytes,
+		.rss = s->rss
+	};
+	if (s->flags & FRAG_LOG_F_SPANS) {
+		g->spans = *s;
+		g->has_spans = true;
+	}
+}
+
+static
+void read_log(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	uint32_t tag;
+	long offset = 0;
+
+	if (!f) {
+		perror(path);
+		exit(1);
+	}
+	while (fread(&tag, sizeof(tag), 1, f) == 1) {
+		if (tag == FRAG_LOG_RUN_TAG) {
+			struct frag_log_run r = {.tag = tag};
+			if (fread((char *)&r + sizeof(tag), sizeof(r) - sizeof(tag), 1, f) != 1) {
+				break;
+			}
+			if (r.version != FRAG_LOG_VERSION || r.buckets != FRAG_LOG_BUCKETS) {
+				fprintf(stderr, "%s: unsupported version %u at offset %ld\n",
+					path, r.version, offset);
+				exit(1);
+			}
+			add_run(&r);
+			offset += sizeof(r);
+		} else if (tag == FRAG_LOG_SAMPLE_TAG) {
+			struct frag_log_sample s = {.tag = tag};
+			if (fread((char *)&s + sizeof(tag), sizeof(s) - sizeof(tag), 1, f) != 1) {
+				break;
+			}
+			add_sample(&s);
+			offset += sizeof(s);
+		} else {
+			fprintf(stderr, "%s: bad record at offset %ld\n", path, offset);
+			exit(1);
+		}
+	}
+	if (!feof(f)) {
+		fprintf(stderr, "%s: truncated record at offset %ld\n", path, offset);
+	}
+	fclose(f);
+}
+
+static
+double waste(const struct point *p)
+{
+	return p->footprint ? ((double)p->footprint - p->live_bytes) * 100 / p->footprint : 0;
+}
+
+struct bucket {
+	int n;
+	double ops;
+	double time;
+	double footprint;
+	double live;
+	double rss;
+	double waste;
+};
+
+/* averages points of group into count buckets of ops */
+static
+struct bucket *make_curve(const struct group *g, int count)
+{
+	struct bucket *b = calloc(count, sizeof(*b));
+	uint64_t max_ops = 0;
+	size_t k;
+	if (!b) {
+		perror("calloc");
+		abort();
+	}
+	for (k = 0; k < g->count; k++) {
+		if (g->points[k].ops > max_ops) {
+			max_ops = g->points[k].ops;
+		}
+	}
+	for (k = 0; k < g->count; k++) {
+		const struct point *p = &g->points[k];
+		int i = max_ops ? (double)p->ops * count / (max_ops + 1) : 0;
+		b[i].n++;
+		b[i].ops += p->ops;
+		b[i].time += p->time_ns / 1e9;
+		b[i].footprint += p->footprint;
+		b[i].live += p->live_bytes;
+		b[i].rss += p->rss;
+		b[i].waste += waste(p);
+	}
+	for (int i = 0; i < count; i++) {
+		if (b[i].n) {
+			b[i].ops /= b[i].n;
+			b[i].time /= b[i].n;
+			b[i].footprint /= b[i].n;
+			b[i].live /= b[i].n;
+			b[i].rss /= b[i].n;
+			b[i].waste /= b[i].n;
+		}
+	}
+	return b;
+}
+
+static
+void print_curve(const struct group *g, const struct bucket *b, int count)
+{
+	printf("# %s -m %d -r %d, %d runs, %zu samples\n",
+	       g->allocator, g->minimal_size, g->size_range, g->runs, g->count);
+	printf("# %14s %10s %12s %12s %12s %8s\n",
+	       "ops", "time_s", "footprint_mb", "live_mb", "rss_mb", "waste%");
+	for (int i = 0; i < count; i++) {
+		if (!b[i].n) {
+			continue;
+		}
+		printf("%16.0f %10.3f %12.1f %12.1f %12.1f %8.3f\n",
+		       b[i].ops, b[i].time, b[i].footprint / 1048576, b[i].live / 1048576,
+		       b[i].rss / 1048576, b[i].waste);
+	}
+	printf("\n\n");
+}
+
+static
+void print_spans(const struct group *g)
+{
+	const struct frag_log_sample *s = &g->spans;
+	if (!g->has_spans) {
+		return;
+	}
+	printf("# free spans of %s -m %d -r %d at %llu ops, %llu free bytes\n",
+	       g->allocator, g->minimal_size, g->size_range,
+	       (unsigned long long)s->ops, (unsigned long long)s->free_bytes);
+	for (int k = 0; k < FRAG_LOG_BUCKETS; k++) {
+		if (s->spans[k]) {
+			printf("%16llu %12llu\n", 1ULL << k, (unsigned long long)s->spans[k]);
+		}
+	}
+	printf("\n\n");
+}
+
+static
+void print_summary_line(const struct group *g, const struct bucket *b, int count)
+{
+	double steady = 0, creep = 0;
+	double sx = 0, sy = 0, sxx = 0, sxy = 0;
+	/* < 0 if even last bucket is off steady state */
+	double settled = -1;
+	int first = -1, last = -1;
+	int n = 0;
+
+	for (int i = 0; i < count; i++) {
+		if (b[i].n) {
+			first = first < 0 ? i : first;
+			last = i;
+		}
+	}
+	if (last < 0) {
+		return;
+	}
+	/* second half of ops */
+	for (int i = (first + last + 1) / 2; i <= last; i++) {
+		double x = b[i].ops / 1e6;
+		if (!b[i].n) {
+			continue;
+		}
+		n++;
+		sx += x;
+		sy += b[i].waste;
+		sxx += x * x;
+		sxy += x * b[i].waste;
+	}
+	steady = sy / n;
+	if (n > 1 && n * sxx - sx * sx > 0) {
+		creep = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+	}
+	for (int i = last; i >= first; i--) {
+		if (b[i].n && fabs(b[i].waste - steady) > 1) {
+			break;
+		}
+		if (b[i].n) {
+			settled = b[i].ops;
+		}
+	}
+	printf("%-20s %8d %8d %5d %14.0f %9.3f %9.3f ",
+	       g->allocator, g->minimal_size, g->size_range, g->runs,
+	       b[last].ops, b[last].waste, steady);
+	if (settled >= 0) {
+		printf("%14.0f", settled);
+	} else {
+		printf("%14s", "n/a");
+	}
+	printf(" %12.4f\n", creep);
+}
+
+static
+void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-n points] [-c] [-S] frag_log\n"
+		"  -n points per curve (default 50)\n"
+		"  -c only curves\n"
+		"  -S also print last free spans histogram\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int points = 50;
+	bool curves_only = false;
+	bool spans = false;
+	struct bucket *curves[MAX_GROUPS];
+	int opt;
+
+	while ((opt = getopt(argc, argv, "cn:S")) != -1) {
+		switch (opt) {
+		case 'c':
+			curves_only = true;
+			break;
+		case 'n':
+			points = atoi(optarg);
+			if (points < 1) {
+				usage(argv[0]);
+			}
+			break;
+		case 'S':
+			spans = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1) {
+		usage(argv[0]);
+	}
+
+	read_log(argv[optind]);
+
+	for (int k = 0; k < groups_count; k++) {
+		curves[k] = make_curve(&groups[k], points);
+		print_curve(&groups[k], curves[k], points);
+		if (spans) {
+			print_spans(&groups[k]);
+		}
+	}
+	if (!curves_only) {
+		printf("# %-18s %8s %8s %5s %14s %9s %9s %14s %12s\n",
+		       "allocator", "min", "range", "runs", "ops", "waste%", "steady%",
+		       "settled_ops", "creep%/Mops");
+		for (int k = 0; k < groups_count; k++) {
+			print_summary_line(&groups[k], curves[k], points);
+		}
+	}
+	return 0;
+}
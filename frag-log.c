@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "frag-log.h"
+
+static int log_fd = -1;
+static uint32_t run_id;
+
+static
+void write_record(const void *rec, size_t size)
+{
+	/* single O_APPEND write, see frag-log.h */
+	if (write(log_fd, rec, size) != (ssize_t)size) {
+		perror("write");
+		abort();
+	}
+}
+
+bool frag_log_open(const char *path, uint64_t interval, const char *allocator,
+		   int minimal_size, int size_range)
+{
+	struct frag_log_run r = {
+		.tag = FRAG_LOG_RUN_TAG,
+		.version = FRAG_LOG_VERSION,
+		.buckets = FRAG_LOG_BUCKETS,
+		.interval = interval,
+		.minimal_size = minimal_size,
+		.size_range = size_range
+	};
+
+	if (log_fd < 0) {
+		log_fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+		if (log_fd < 0) {
+			return false;
+		}
+	}
+	run_id = r.run = getpid();
+	strncpy(r.allocator, allocator, sizeof(r.allocator) - 1);
+	write_record(&r, sizeof(r));
+	return true;
+}
+
+void frag_log_add_spans(struct frag_log_sample *s, size_t size, size_t count)
+{
+	int k = size ? 63 - __builtin_clzll(size) : 0;
+	if (k >= FRAG_LOG_BUCKETS) {
+		k = FRAG_LOG_BUCKETS - 1;
+	}
+	s->spans[k] += count;
+	s->free_bytes += size * count;
+}
+
+void frag_log_write(struct frag_log_sample *s)
+{
+	s->tag = FRAG_LOG_SAMPLE_TAG;
+	s->run = run_id;
+	write_record(s, sizeof(*s));
+}
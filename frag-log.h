@@ -0,0 +1,64 @@
+#ifndef FRAG_LOG_H
+#define FRAG_LOG_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/*
+ * Fragmentation time series (-l). Binary, append only file of fixed
+ * size records in host byte order, read by frag-log-read. Every run
+ * first appends struct frag_log_run, then struct frag_log_sample
+ * every interval allocs and frees. Both start with tag, and carry run id
+ * (pid), so that runs of sweep children can share one file and
+ * interleave.
+ *
+ * spans[k] counts free spans of allocator of size in [2^k, 2^(k+1)),
+ * as reported by it's iterate_free. For buddy, that is exactly count
+ * of free blocks of order k. Samples without FRAG_LOG_F_SPANS have no
+ * span data (allocator can't walk free memory, or sample was taken
+ * while workload threads were running).
+ */
+
+#define FRAG_LOG_RUN_TAG 0x4c465842 /* "BXFL" */
+#define FRAG_LOG_SAMPLE_TAG 0x504d5353 /* "SSMP" */
+#define FRAG_LOG_VERSION 1
+
+#define FRAG_LOG_BUCKETS 48
+
+#define FRAG_LOG_F_SPANS 1
+
+struct frag_log_run {
+	uint32_t tag;
+	uint32_t version;
+	uint32_t run;
+	uint32_t buckets;
+	uint64_t interval;
+	int32_t minimal_size;
+	int32_t size_range;
+	char allocator[64];
+};
+
+struct frag_log_sample {
+	uint32_t tag;
+	uint32_t run;
+	uint32_t flags;
+	uint32_t reserved;
+	/* since start of run */
+	uint64_t time_ns;
+	uint64_t ops;
+	uint64_t allocs;
+	uint64_t footprint;
+	uint64_t live_bytes;
+	uint64_t live_count;
+	uint64_t rss;
+	uint64_t free_bytes;
+	uint64_t spans[FRAG_LOG_BUCKETS];
+};
+
+/* false if file can't be opened */
+extern bool frag_log_open(const char *path, uint64_t interval, const char *allocator,
+			  int minimal_size, int size_range);
+extern void frag_log_add_spans(struct frag_log_sample *s, size_t size, size_t count);
+extern void frag_log_write(struct frag_log_sample *s);
+
+#endif
@@ -2,8 +2,10 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <malloc.h>
 /* #include <jemalloc/jemalloc.h> */
 #include "common.h"
+#include "prefault.h"
 
 /* 
  * static bool inited;
@@ -22,7 +24,7 @@
 void *je_allocate_blob(size_t size)
 {
 	/* maybe_init(); */
-	return touch_pages(malloc(size), size);
+	return prefault_alloc(malloc(size), size);
 }
 
 void je_free_blob(void *blob, size_t _unused)
@@ -66,9 +68,29 @@ size_t je_get_total_allocated_size(void)
 	return rss_allocated();
 }
 
+/* budget is ignored, malloc_trim gives back everything it can */
+size_t je_release_free_memory(size_t budget)
+{
+	/* 
+	 * size_t narenas;
+	 * size_t len = sizeof(narenas);
+	 * char cmd[64];
+	 * mallctl("arenas.narenas", &narenas, &len, NULL, 0);
+	 * snprintf(cmd, sizeof(cmd), "arena.%zu.purge", narenas);
+	 * mallctl(cmd, NULL, NULL, NULL, 0);
+	 */
+	size_t before = rss_allocated();
+	size_t after;
+	malloc_trim(0);
+	after = rss_allocated();
+	return before > after ? before - after : 0;
+}
+
 allocation_functions jemalloc_fns = {
 	.name = "jemalloc",
+	.thread_safe = true,
 	.alloc = je_allocate_blob,
 	.free = je_free_blob,
-	.get_total_allocated_size = je_get_total_allocated_size
+	.get_total_allocated_size = je_get_total_allocated_size,
+	.release_free_memory = je_release_free_memory
 };
@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "latency.h"
+
+#define MAX_LAT_SETS 1024
+
+bool lat_enabled;
+
+static struct lat_set main_set;
+__thread struct lat_set *lat_thread_set = &main_set;
+__thread enum lat_phase lat_phase;
+
+static struct lat_set *all_sets[MAX_LAT_SETS] = {&main_set};
+static int all_sets_count = 1;
+static pthread_mutex_t all_sets_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *op_names[LAT_OPS] = {"alloc", "free"};
+static const char *phase_names[LAT_PHASES] = {"fill", "bump", "random free", "replay"};
+static const char *class_names[LAT_SIZE_CLASSES] = {
+	"<=256", "<=1K", "<=4K", "<=16K", "<=64K", "<=256K", "<=1M", ">1M"
+};
+
+void lat_register_thread(void)
+{
+	struct lat_set *set = calloc(1, sizeof(*set));
+	if (!set) {
+		perror("calloc");
+		abort();
+	}
+	pthread_mutex_lock(&all_sets_lock);
+	if (all_sets_count >= MAX_LAT_SETS) {
+		fprintf(stderr, "too many latency sets\n");
+		abort();
+	}
+	all_sets[all_sets_count++] = set;
+	pthread_mutex_unlock(&all_sets_lock);
+	lat_thread_set = set;
+}
+
+/* upper bound of values that fall into bucket b */
+static
+uint64_t bucket_upper(unsigned b)
+{
+	unsigned e;
+	if (b < (1U << LAT_SUB_BITS)) {
+		return b;
+	}
+	e = (b >> LAT_SUB_BITS) + LAT_SUB_BITS - 1;
+	return ((((uint64_t)1 << LAT_SUB_BITS) + (b & ((1U << LAT_SUB_BITS) - 1)) + 1) << (e - LAT_SUB_BITS)) - 1;
+}
+
+static
+uint64_t percentile(const struct lat_hist *h, double q)
+{
+	uint64_t target = (uint64_t)(q * h->count);
+	uint64_t seen = 0;
+	unsigned b;
+	if (target >= h->count) {
+		target = h->count - 1;
+	}
+	for (b = 0; b < LAT_BUCKETS; b++) {
+		seen += h->buckets[b];
+		if (seen > target) {
+			uint64_t v = bucket_upper(b);
+			return v < h->max ? v : h->max;
+		}
+	}
+	return h->max;
+}
+
+static
+void merge_hist(struct lat_hist *to, const struct lat_hist *from)
+{
+	unsigned b;
+	to->count += from->count;
+	if (from->max > to->max) {
+		to->max = from->max;
+	}
+	for (b = 0; b < LAT_BUCKETS; b++) {
+		to->buckets[b] += from->buckets[b];
+	}
+}
+
+/* rdtsc ticks per nanosecond, measured once */
+static
+double ticks_per_ns(void)
+{
+	static double rv;
+	struct timespec a, b;
+	struct timespec sleep = {.tv_sec = 0, .tv_nsec = 20000000};
+	uint64_t ta, tb;
+	if (rv) {
+		return rv;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &a);
+	ta = lat_now();
+	nanosleep(&sleep, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &b);
+	tb = lat_now();
+	rv = (double)(tb - ta) / ((b.tv_sec - a.tv_sec) * 1e9 + (b.tv_nsec - a.tv_nsec));
+	return rv;
+}
+
+static
+void print_hist(FILE *f, const char *name, const struct lat_hist *h, double tpn)
+{
+	fprintf(f, "  %-8s count %10llu  p50 %8.0f  p99 %8.0f  p99.9 %8.0f  max %10.0f ns\n",
+		name, (unsigned long long)h->count,
+		percentile(h, 0.5) / tpn,
+		percentile(h, 0.99) / tpn,
+		percentile(h, 0.999) / tpn,
+		h->max / tpn);
+}
+
+static struct lat_set merged;
+
+static
+void merge_all_sets(void)
+{
+	int op, phase, cls, k;
+	memset(&merged, 0, sizeof(merged));
+	pthread_mutex_lock(&all_sets_lock);
+	for (k = 0; k < all_sets_count; k++) {
+		for (op = 0; op < LAT_OPS; op++)
+			for (phase = 0; phase < LAT_PHASES; phase++)
+				for (cls = 0; cls < LAT_SIZE_CLASSES; cls++)
+					merge_hist(&merged.h[op][phase][cls],
+						   &all_sets[k]->h[op][phase][cls]);
+	}
+	pthread_mutex_unlock(&all_sets_lock);
+}
+
+bool lat_summary(enum lat_op op, double pct_ns[4])
+{
+	static struct lat_hist total;
+	double tpn = ticks_per_ns();
+	int phase, cls;
+
+	merge_all_sets();
+	memset(&total, 0, sizeof(total));
+	for (phase = 0; phase < LAT_PHASES; phase++) {
+		for (cls = 0; cls < LAT_SIZE_CLASSES; cls++) {
+			merge_hist(&total, &merged.h[op][phase][cls]);
+		}
+	}
+	if (!total.count) {
+		return false;
+	}
+	pct_ns[0] = percentile(&total, 0.5) / tpn;
+	pct_ns[1] = percentile(&total, 0.99) / tpn;
+	pct_ns[2] = percentile(&total, 0.999) / tpn;
+	pct_ns[3] = total.max / tpn;
+	return true;
+}
+
+void lat_print(FILE *f)
+{
+	double tpn = ticks_per_ns();
+	int op, phase, cls;
+
+	merge_all_sets();
+
+	for (op = 0; op < LAT_OPS; op++) {
+		for (phase = 0; phase < LAT_PHASES; phase++) {
+			struct lat_hist total;
+			memset(&total, 0, sizeof(total));
+			for (cls = 0; cls < LAT_SIZE_CLASSES; cls++) {
+				merge_hist(&total, &merged.h[op][phase][cls]);
+			}
+			if (!total.count) {
+				continue;
+			}
+			fprintf(f, "latency %s, %s:\n", op_names[op], phase_names[phase]);
+			print_hist(f, "all", &total, tpn);
+			for (cls = 0; cls < LAT_SIZE_CLASSES; cls++) {
+				if (merged.h[op][phase][cls].count) {
+					print_hist(f, class_names[cls], &merged.h[op][phase][cls], tpn);
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,117 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+/*
+ * Per operation latency histograms. Log-linear (HDR-style) buckets:
+ * values below 2^LAT_SUB_BITS are exact, above that every power of
+ * two is split into 2^LAT_SUB_BITS buckets, i.e. ~6% precision.
+ *
+ * There is one histogram per (op, phase, size class). Recording only
+ * touches preallocated per-thread set, so it never allocates and
+ * costs few cycles on top of the two timestamps.
+ */
+
+#define LAT_SUB_BITS 4
+#define LAT_BUCKETS (64 << LAT_SUB_BITS)
+/* <=256, <=1K, <=4K, ... <=1M, bigger */
+#define LAT_SIZE_CLASSES 8
+
+enum lat_op {
+	LAT_ALLOC,
+	LAT_FREE,
+	LAT_OPS
+};
+
+enum lat_phase {
+	LAT_PHASE_FILL,
+	LAT_PHASE_BUMP,
+	LAT_PHASE_FREE,
+	LAT_PHASE_REPLAY,
+	LAT_PHASES
+};
+
+struct lat_hist {
+	uint64_t count;
+	uint64_t max;
+	uint64_t buckets[LAT_BUCKETS];
+};
+
+struct lat_set {
+	struct lat_hist h[LAT_OPS][LAT_PHASES][LAT_SIZE_CLASSES];
+};
+
+extern bool lat_enabled;
+extern __thread struct lat_set *lat_thread_set;
+extern __thread enum lat_phase lat_phase;
+
+/* gives calling thread it's own histograms. Threads that don't call
+ * it record into main thread's ones */
+extern void lat_register_thread(void);
+/* merges all threads histograms and prints percentiles */
+extern void lat_print(FILE *f);
+/* p50, p99, p99.9 and max in ns of op over all phases and size
+ * classes. false if nothing was recorded */
+extern bool lat_summary(enum lat_op op, double pct_ns[4]);
+
+static inline
+void lat_set_phase(enum lat_phase phase)
+{
+	lat_phase = phase;
+}
+
+static inline
+uint64_t lat_now(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static inline
+unsigned lat_bucket(uint64_t v)
+{
+	unsigned e;
+	if (v < (1U << LAT_SUB_BITS)) {
+		return v;
+	}
+	e = 63 - __builtin_clzll(v);
+	return ((e - LAT_SUB_BITS + 1) << LAT_SUB_BITS)
+		+ ((v >> (e - LAT_SUB_BITS)) & ((1U << LAT_SUB_BITS) - 1));
+}
+
+static inline
+unsigned lat_size_class(size_t size)
+{
+	unsigned cls;
+	if (size <= 256) {
+		return 0;
+	}
+	cls = (64 - __builtin_clzll(size - 1) - 7) / 2;
+	return cls < LAT_SIZE_CLASSES ? cls : LAT_SIZE_CLASSES - 1;
+}
+
+static inline
+void lat_record(enum lat_op op, size_t size, uint64_t cycles)
+{
+	struct lat_hist *h = &lat_thread_set->h[op][lat_phase][lat_size_class(size)];
+	h->buckets[lat_bucket(cycles)]++;
+	h->count++;
+	if (cycles > h->max) {
+		h->max = cycles;
+	}
+}
+
+#endif
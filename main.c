@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -8,129 +9,1900 @@
 #include <sys/time.h>
 #include <sys/uio.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+#include <math.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <limits.h>
+#include <signal.h>
 #include "common.h"
+#include "scavenger.h"
+#include "memsample.h"
+#include "latency.h"
+#include "trace.h"
+#include "size-dist.h"
+#include "scenario.h"
+#include "stats-out.h"
+#include "blob-table.h"
+#include "rng.h"
+#include "prefault.h"
+#include "frag-log.h"
+#include "perf-counters.h"
 
 static void dump_chunks(const char *path);
+static void frag_log_sample(unsigned long ops, unsigned long allocs, bool spans);
+
+/* allocators that are not thread_safe are serialized by this lock
+ * when multiple workload threads are running */
+static pthread_mutex_t serialize_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool serialize_allocs;
+
+/* allocs and frees done by this thread */
+static __thread unsigned long thread_blob_ops;
+static __thread unsigned long thread_blob_allocs;
+
+/* thread_blob_ops of next fragmentation sample. Stays ULONG_MAX
+ * without -l and in multi-threaded workload */
+static unsigned long frag_log_next = ULONG_MAX;
+
+static
+void *allocate_blob(unsigned size)
+{
+	void *rv;
+	uint64_t start = 0;
+	bool scavenger_locked = scavenger_enter();
+	if (serialize_allocs) {
+		pthread_mutex_lock(&serialize_lock);
+	}
+	if (lat_enabled) {
+		start = lat_now();
+	}
+	rv = main_fns->alloc(size);
+	thread_blob_ops++;
+	thread_blob_allocs++;
+	if (lat_enabled) {
+		lat_record(LAT_ALLOC, size, lat_now() - start);
+	}
+	if (serialize_allocs) {
+		pthread_mutex_unlock(&serialize_lock);
+	}
+	scavenger_leave(scavenger_locked);
+	if (thread_blob_ops >= frag_log_next) {
+		frag_log_sample(thread_blob_ops, thread_blob_allocs, true);
+	}
+	return rv;
+}
+
+static
+void free_blob(void *blob, size_t size)
+{
+	uint64_t start = 0;
+	bool scavenger_locked = scavenger_enter();
+	if (serialize_allocs) {
+		pthread_mutex_lock(&serialize_lock);
+	}
+	if (lat_enabled) {
+		start = lat_now();
+	}
+	main_fns->free(blob, size);
+	thread_blob_ops++;
+	if (lat_enabled) {
+		lat_record(LAT_FREE, size, lat_now() - start);
+	}
+	if (serialize_allocs) {
+		pthread_mutex_unlock(&serialize_lock);
+	}
+	scavenger_leave(scavenger_locked);
+	if (thread_blob_ops >= frag_log_next) {
+		frag_log_sample(thread_blob_ops, thread_blob_allocs, true);
+	}
+}
+
+/* phases are shared by latency histograms and perf counters */
+static
+void set_phase(enum lat_phase phase)
+{
+	lat_set_phase(phase);
+	if (perf_enabled) {
+		perf_set_phase(phase, thread_blob_ops);
+	}
+}
+
+static
+size_t get_total_allocated_size(void)
+{
+	return main_fns->get_total_allocated_size();
+}
+
+#define ALLOCATE_UNTIL_MB ((1200 + 15) / 16 * 16 - 1)
+
+static size_t usefully_allocated;
+static long useful_allocations_count;
+/* random workload allocates up to that (-a) */
+static size_t fill_target = (size_t)ALLOCATE_UNTIL_MB << 20;
+
+double max_waste;
+
+int minimal_size = 128;
+int size_range = 65536;
+
+/* for machine readable stats. Multi-threaded workload sets
+ * stats_ops itself, otherwise it is ops done by main thread */
+static const char *stats_phase = "random";
+static char stack_label[64];
+static uint64_t stats_start_ns;
+static unsigned long stats_ops;
+static double stats_ops_per_sec = -1;
+
+static
+uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static
+void emit_stats_record(size_t total_ram, double waste, const struct mem_sample *ms)
+{
+	struct stats_record rec = {
+		.time = (now_ns() - stats_start_ns) / 1e9,
+		.phase = stats_phase,
+		.allocator = stack_label,
+		.minimal_size = minimal_size,
+		.size_range = size_range,
+		.footprint = total_ram,
+		.live_bytes = usefully_allocated,
+		.live_count = useful_allocations_count,
+		.waste = waste,
+		.max_waste = max_waste,
+		.ops = stats_ops ? stats_ops : thread_blob_ops,
+		.ops_per_sec = stats_ops_per_sec,
+		.minflt = ms->minflt,
+		.majflt = ms->majflt,
+		.rss = ms->rss,
+		.pss = ms->pss
+	};
+	if (lat_enabled) {
+		rec.has_latency[LAT_ALLOC] = lat_summary(LAT_ALLOC, rec.latency[LAT_ALLOC]);
+		rec.has_latency[LAT_FREE] = lat_summary(LAT_FREE, rec.latency[LAT_FREE]);
+	}
+	if (perf_enabled) {
+		perf_summary(rec.has_perf, rec.perf);
+	}
+	stats_out_write(&rec);
+}
+
+static
+void print_current_stats(void)
+{
+	/* stats are not part of phase they interrupt */
+	int perf_phase = perf_set_phase(PERF_NO_PHASE, thread_blob_ops);
+	size_t total_ram = get_total_allocated_size();
+	double waste = total_ram ? ((double)total_ram - usefully_allocated) * 100 / total_ram : 0;
+	struct mem_sample ms;
+	if (waste > max_waste) {
+		max_waste = waste;
+	}
+	memsample_get(&ms);
+	printf("got from OS: %zu\nApp allocated: %zu\nAllocations count:%ld\nwaste %f %f %%\n"
+	       "page faults: %ld minor, %ld major\n",
+	       total_ram,
+	       usefully_allocated,
+	       useful_allocations_count,
+	       waste, max_waste,
+	       ms.minflt, ms.majflt);
+	prefault_print(stdout, ms.minflt);
+	if (ms.pss) {
+		printf("rss: %zu pss: %zu\n", ms.rss, ms.pss);
+	}
+	if (main_fns->print_details) {
+		main_fns->print_details(stdout);
+	}
+	if (lat_enabled) {
+		lat_print(stdout);
+	}
+	if (perf_enabled) {
+		perf_print(stdout);
+	}
+	if (stats_out_enabled()) {
+		emit_stats_record(total_ram, waste, &ms);
+	}
+	perf_set_phase(perf_phase, thread_blob_ops);
+}
+
+/*
+ * Fragmentation time series (-l, see frag-log.h). Single threaded
+ * workloads sample every frag_log_interval allocs and frees, right
+ * after op that crossed it. Multi-threaded one samples (without free
+ * spans) whenever it prints stats.
+ *
+ * Sample may walk whole heap, which costs time and trashes caches.
+ * So timed benchmark reps are only sampled at their ends, and time
+ * spent sampling is left out of scenario phase timings.
+ */
+static const char *frag_log_path;
+static unsigned long frag_log_interval = 100000;
+static uint64_t frag_log_start_ns;
+static uint64_t frag_log_spent_ns;
+
+static
+void frag_log_span_cb(size_t size, size_t count, void *data)
+{
+	frag_log_add_spans(data, size, count);
+}
+
+static
+void frag_log_sample(unsigned long ops, unsigned long allocs, bool spans)
+{
+	uint64_t start = now_ns();
+	struct frag_log_sample s = {
+		.time_ns = start - frag_log_start_ns,
+		.ops = ops,
+		.allocs = allocs,
+		.footprint = get_total_allocated_size(),
+		.live_bytes = usefully_allocated,
+		.live_count = useful_allocations_count,
+		.rss = rss_allocated()
+	};
+	int perf_phase = perf_set_phase(PERF_NO_PHASE, ops);
+	if (spans && main_fns->iterate_free) {
+		/* not an op, so scavenger's idle time keeps running */
+		bool scavenger_locked = __atomic_load_n(&scavenger_running, __ATOMIC_ACQUIRE);
+		if (scavenger_locked) {
+			pthread_mutex_lock(&scavenger_lock);
+		}
+		main_fns->iterate_free(&s, frag_log_span_cb);
+		if (scavenger_locked) {
+			pthread_mutex_unlock(&scavenger_lock);
+		}
+		s.flags |= FRAG_LOG_F_SPANS;
+	}
+	frag_log_write(&s);
+	perf_set_phase(perf_phase, ops);
+	if (frag_log_next != ULONG_MAX) {
+		frag_log_next = ops + frag_log_interval;
+	}
+	frag_log_spent_ns += now_ns() - start;
+}
+
+/* starts run in log, once allocator and sizes are set up */
+static
+void frag_log_begin(bool sampled_by_ops)
+{
+	if (!frag_log_path) {
+		return;
+	}
+	if (!frag_log_open(frag_log_path, frag_log_interval, stack_label,
+			   minimal_size, size_range)) {
+		perror(frag_log_path);
+		exit(1);
+	}
+	frag_log_start_ns = now_ns();
+	if (sampled_by_ops) {
+		frag_log_next = thread_blob_ops + frag_log_interval;
+	}
+}
+
+/* blob table is sized at startup, by -N or by default from heap size
+ * and mean blob size */
+#define MIN_BLOBS_COUNT (1024*1024)
+
+static int blobs_count;
+static struct blob_table blobs;
+
+/*
+ * Instead of uniform [minimal_size, minimal_size + size_range),
+ * random workloads can draw sizes from histograms (-D). With several
+ * of them, distribution drifts from each histogram to next one (and
+ * from last back to first) over size_mix_period fill iterations.
+ */
+static struct size_dist *size_dists[MAX_SIZE_DISTS];
+static int size_dists_count;
+static int size_mix_period = 10000;
+static unsigned long fill_iterations;
+
+/* stream 0 is main thread's, threads of multi-threaded workload use
+ * their own */
+static struct rng workload_rng;
+
+/* bounds of random sizes, bumps grow lower half of them */
+static unsigned sizes_lo;
+static unsigned sizes_hi;
+
+static
+unsigned mixed_size(unsigned long iteration, uint32_t r1, uint32_t r2, uint32_t r3)
+{
+	const struct size_dist *d = size_dists[0];
+	if (size_dists_count > 1) {
+		unsigned long seg = iteration / size_mix_period;
+		/* weight of next histogram, scaled to 2^31 */
+		uint32_t w = (uint64_t)(iteration % size_mix_period) * (1U << 31) / size_mix_period;
+		d = size_dists[(seg + (r3 < w)) % size_dists_count];
+	}
+	return size_dist_sample(d, r1, r2);
+}
+
+static
+unsigned random_size(void)
+{
+	uint32_t r1, r2, r3 = 0;
+	if (!size_dists_count) {
+		return minimal_size + rng_below(&workload_rng, size_range);
+	}
+	r1 = rng_u31(&workload_rng);
+	r2 = rng_u31(&workload_rng);
+	if (size_dists_count > 1) {
+		r3 = rng_u31(&workload_rng);
+	}
+	return mixed_size(fill_iterations, r1, r2, r3);
+}
+
+static
+void setup_sizes(void)
+{
+	sizes_lo = minimal_size;
+	sizes_hi = minimal_size + size_range;
+	if (!size_dists_count) {
+		return;
+	}
+	sizes_lo = UINT32_MAX;
+	sizes_hi = 0;
+	for (int k = 0; k < size_dists_count; k++) {
+		struct size_dist *d = size_dists[k];
+		unsigned hi = d->base[0] + d->width[0];
+		for (int i = 0; i < d->count; i++) {
+			if (d->base[i] + d->width[i] > hi) {
+				hi = d->base[i] + d->width[i];
+			}
+		}
+		if (d->base[0] < sizes_lo) {
+			sizes_lo = d->base[0];
+		}
+		if (hi > sizes_hi) {
+			sizes_hi = hi;
+		}
+		printf("size_dist = %s (%d buckets, mean %.1f)\n", d->path, d->count, d->mean);
+	}
+	if (size_dists_count > 1) {
+		printf("size_mix_period = %d\n", size_mix_period);
+	}
+}
+
+/* count 0 means twice as many slots as fill_target needs with
+ * current sizes, but at least MIN_BLOBS_COUNT */
+static
+void setup_blob_table(int count)
+{
+	if (!count) {
+		double mean = sizes_lo + (sizes_hi - sizes_lo) / 2.0;
+		double need;
+		for (int k = 0; k < size_dists_count; k++) {
+			if (size_dists[k]->mean < mean) {
+				mean = size_dists[k]->mean;
+			}
+		}
+		need = 2.0 * fill_target / mean;
+		count = need < MIN_BLOBS_COUNT ? MIN_BLOBS_COUNT
+			: need < INT32_MAX ? need : INT32_MAX;
+	}
+	if (blobs.count) {
+		blob_table_destroy(&blobs);
+	}
+	blobs_count = count;
+	blob_table_init(&blobs, count);
+}
+
+/* grows sizes of smaller half of blobs in table by 1/256, while
+ * keeping *allocated under limit. Returns count of allocs and frees
+ * done */
+static
+unsigned long bump_range(struct blob_table *t, size_t *allocated, long *count, size_t limit)
+{
+	unsigned long ops = 0;
+	enum lat_phase saved_phase = lat_phase;
+	set_phase(LAT_PHASE_BUMP);
+	/* backwards, so that removal only moves already visited blob */
+	for (int i = t->live - 1; i >= 0; i--) {
+		int k = blob_table_live_slot(t, i);
+		unsigned old_size = t->sizes[k];
+		unsigned new_size = old_size + (old_size >> 8);
+		if (old_size > sizes_lo + (sizes_hi - sizes_lo) / 2) {
+			continue;
+		}
+		if (new_size > sizes_hi) {
+			new_size = sizes_hi;
+		}
+		if (new_size == old_size) {
+			continue;
+		}
+		free_blob(t->ptrs[k], old_size);
+		*allocated -= old_size;
+		(*count)--;
+		ops++;
+		if (*allocated < limit) {
+			t->ptrs[k] = allocate_blob(new_size);
+			t->sizes[k] = new_size;
+			*allocated += new_size;
+			(*count)++;
+			ops++;
+		} else {
+			blob_table_remove(t, k);
+		}
+	}
+	set_phase(saved_phase);
+	return ops;
+}
+
+static
+unsigned long bump_sizes(void)
+{
+	return bump_range(&blobs, &usefully_allocated, &useful_allocations_count,
+			  fill_target);
+}
+
+/* allocates random sized blobs into free slots until fill_target is
+ * reached. false if we ran out of slots */
+static
+bool random_fill(unsigned long *ops)
+{
+	set_phase(LAT_PHASE_FILL);
+	do {
+		int slot = blob_table_free_slot(&blobs);
+		unsigned size;
+		if (slot < 0) {
+			return false;
+		}
+		size = random_size();
+		blob_table_add_at(&blobs, slot, allocate_blob(size), size);
+		usefully_allocated += size;
+		useful_allocations_count++;
+		(*ops)++;
+	} while (usefully_allocated < fill_target);
+	fill_iterations++;
+	return true;
+}
+
+static
+void free_slot(int slot, unsigned long *ops)
+{
+	usefully_allocated -= blobs.sizes[slot];
+	useful_allocations_count--;
+	free_blob(blobs.ptrs[slot], blobs.sizes[slot]);
+	blob_table_remove(&blobs, slot);
+	(*ops)++;
+}
+
+/* frees given per mille of live blobs at random. Jumps straight
+ * between freed ones, so it costs random number per free, not per
+ * live blob */
+static
+void random_free(int per_mille, unsigned long *ops)
+{
+	double log_q = log1p(-per_mille / 1000.0);
+	set_phase(LAT_PHASE_FREE);
+	if (per_mille <= 0) {
+		return;
+	}
+	/* backwards, so that removal only moves already visited blob */
+	for (long i = blobs.live - 1 - (long)rng_geometric(&workload_rng, log_q); i >= 0;
+	     i -= 1 + (long)rng_geometric(&workload_rng, log_q)) {
+		free_slot(blob_table_live_slot(&blobs, i), ops);
+	}
+}
+
+/* frees random live blobs, until at most bytes are left */
+static
+void random_free_down_to(size_t bytes, unsigned long *ops)
+{
+	set_phase(LAT_PHASE_FREE);
+	while (usefully_allocated > bytes && blobs.live) {
+		free_slot(blob_table_sample(&blobs, rng_u31(&workload_rng)), ops);
+	}
+}
+
+/* drops all blobs. Via allocator's reset if it has one, so that it
+ * keeps (and doesn't have to fault in again) it's memory */
+static
+void reset_heap(void)
+{
+	/* tearing down isn't part of any measured phase */
+	bool saved_lat_enabled = lat_enabled;
+	int perf_phase = perf_set_phase(PERF_NO_PHASE, thread_blob_ops);
+	lat_enabled = false;
+	if (!main_fns->reset || !main_fns->reset()) {
+		for (int i = 0; i < blobs.live; i++) {
+			int k = blob_table_live_slot(&blobs, i);
+			free_blob(blobs.ptrs[k], blobs.sizes[k]);
+		}
+	}
+	blob_table_clear(&blobs);
+	usefully_allocated = 0;
+	useful_allocations_count = 0;
+	lat_enabled = saved_lat_enabled;
+	perf_set_phase(perf_phase, thread_blob_ops);
+}
+
+/*
+ * Persistent mini heap (-P). Live blobs are kept in heap itself, in
+ * block pointed to by heap's root, so that next run takes them over
+ * instead of leaking them. Block is written at exit, right before
+ * heap is closed, and freed as soon as it's read back.
+ *
+ * Heap killed in the middle of run stays dirty and can't be
+ * reattached, so SIGINT and SIGTERM only ask workload to exit
+ * between ops.
+ */
+struct persisted_blobs {
+	size_t size;
+	long count;
+	struct {
+		void *p;
+		uint32_t size;
+	} blobs[];
+};
+
+static void **persist_root;
+static volatile sig_atomic_t stop_requested;
+
+static
+void stop_handler(int sig)
+{
+	stop_requested = 1;
+}
+
+static
+void check_stop(void)
+{
+	if (stop_requested) {
+		printf("\nstopped by signal\n");
+		exit(1);
+	}
+}
+
+static
+void save_persisted_blobs(void)
+{
+	size_t size = sizeof(struct persisted_blobs)
+		+ (size_t)blobs.live * sizeof(((struct persisted_blobs *)0)->blobs[0]);
+	struct persisted_blobs *pb = main_fns->alloc(size);
+	if (!pb) {
+		fprintf(stderr, "no room to save %d blobs, they are lost\n", blobs.live);
+		return;
+	}
+	pb->size = size;
+	pb->count = blobs.live;
+	for (int i = 0; i < blobs.live; i++) {
+		int k = blob_table_live_slot(&blobs, i);
+		pb->blobs[i].p = blobs.ptrs[k];
+		pb->blobs[i].size = blobs.sizes[k];
+	}
+	*persist_root = pb;
+}
+
+static
+void restore_persisted_blobs(void)
+{
+	struct persisted_blobs *pb = *persist_root;
+	long dropped = 0;
+	if (!pb) {
+		return;
+	}
+	for (long i = 0; i < pb->count; i++) {
+		int slot = blob_table_free_slot(&blobs);
+		if (slot < 0) {
+			/* this run has smaller blob table */
+			main_fns->free(pb->blobs[i].p, pb->blobs[i].size);
+			dropped++;
+			continue;
+		}
+		blob_table_add_at(&blobs, slot, pb->blobs[i].p, pb->blobs[i].size);
+		usefully_allocated += pb->blobs[i].size;
+		useful_allocations_count++;
+	}
+	printf("restored %ld blobs, %zu bytes (%ld dropped)\n",
+	       pb->count - dropped, usefully_allocated, dropped);
+	*persist_root = NULL;
+	main_fns->free(pb, pb->size);
+}
+
+static
+void attach_persistent_heap(void)
+{
+	struct sigaction sa = {.sa_handler = stop_handler, .sa_flags = SA_RESETHAND};
+	bool reattached;
+
+	persist_root = mini_attach_persistent(&reattached);
+	if (reattached) {
+		restore_persisted_blobs();
+	}
+	/* atexit handlers run in reverse, so this is before heap's
+	 * close */
+	atexit(save_persisted_blobs);
+	/* second signal kills as usual */
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+}
+
+/* in iterations of main loop */
+#define COMPACT_INTERVAL 1000
+
+static size_t compact_budget;
+static size_t compact_released;
+static size_t compact_moved;
+
+struct blob_by_addr {
+	void *blob;
+	int idx;
+};
+
+static struct blob_by_addr *compact_index;
+static int compact_index_count;
+
+static
+int blob_by_addr_cmp(const void *_a, const void *_b)
+{
+	const struct blob_by_addr *a = _a;
+	const struct blob_by_addr *b = _b;
+	return (a->blob > b->blob) - (a->blob < b->blob);
+}
+
+/* built lazily on first relocation, since most compaction calls
+ * don't move anything */
+static
+void build_compact_index(void)
+{
+	int count = blobs.live;
+	compact_index = malloc(sizeof(*compact_index) * count);
+	if (!compact_index) {
+		perror("malloc");
+		abort();
+	}
+	for (int i = 0; i < count; i++) {
+		int k = blob_table_live_slot(&blobs, i);
+		compact_index[i].blob = blobs.ptrs[k];
+		compact_index[i].idx = k;
+	}
+	qsort(compact_index, count, sizeof(*compact_index), blob_by_addr_cmp);
+	compact_index_count = count;
+}
+
+static
+void relocate_blob(void *old_p, void *new_p, void *dummy)
+{
+	struct blob_by_addr key = {.blob = old_p};
+	struct blob_by_addr *found;
+	if (!compact_index) {
+		build_compact_index();
+	}
+	found = bsearch(&key, compact_index, compact_index_count,
+			sizeof(*compact_index), blob_by_addr_cmp);
+	if (!found) {
+		fprintf(stderr, "relocated unknown blob %p\n", old_p);
+		abort();
+	}
+	blobs.ptrs[found->idx] = new_p;
+	compact_moved += blobs.sizes[found->idx];
+}
+
+static
+void compact_heap(void)
+{
+	compact_released += main_fns->compact(compact_budget, relocate_blob, NULL);
+	free(compact_index);
+	compact_index = NULL;
+}
+
+/*
+ * Trace replay. Both simple_dump (flat array of {key, len} records)
+ * and v2 traces (see trace.h) are mmap-ed and decoded into batches
+ * of validated events, which are then applied to heap. Decoding and
+ * allocating are timed separately. Consumed part of mapping is
+ * dropped every REPLAY_DROP_BYTES, so that page cache of huge traces
+ * doesn't show up in our rss.
+ */
+
+#define REPLAY_BATCH 4096
+#define REPLAY_DROP_BYTES (64 << 20)
+
+typedef struct {
+	uint32_t sec;
+	uint32_t len;
+} sim_evt_t;
+
+struct replay_op {
+	enum trace_event_type type;
+	uint32_t key;
+	uint32_t len;
+};
+
+struct replay_source {
+	/* v2 trace, or */
+	struct trace_reader *reader;
+	bool addresses;
+	/* simple_dump */
+	char *map;
+	size_t total;
+	size_t offset;
+	size_t dropped;
+};
+
+struct replay_stats {
+	unsigned long events;
+	unsigned long skipped_small;
+	unsigned long bad_keys;
+	/* address traces only */
+	unsigned long unmatched_frees;
+	unsigned long out_of_slots;
+	uint64_t decode_ns;
+	uint64_t alloc_ns;
+};
+
+/*
+ * Traces recorded by malloc-recorder.so have addresses as keys. They
+ * are mapped into blob slots by open addressing hash table (linear
+ * probing, backward shift deletion). Slots are handed out from 0 up,
+ * freed ones are reused from stack first.
+ *
+ * Both table and stack are sized by trace's live set and grow on
+ * demand, since RSS of harness counts as footprint of mini, dl, je and
+ * dlms. They are mmap-ed, so that they don't move brk under dl's
+ * sbrk-ed heap, which then couldn't trim it's top.
+ */
+
+#define ADDR_MAP_MIN_BITS 12
+
+static int addr_map_bits;
+#define ADDR_MAP_SIZE ((size_t)1 << addr_map_bits)
+
+struct addr_slot {
+	uint64_t addr;
+	int slot;
+};
+
+static struct addr_slot *addr_map;
+/* entries in use, kept at most half of ADDR_MAP_SIZE */
+static size_t addr_map_used;
+/* slots below it were handed out at some point */
+static int next_free_slot;
+static int *free_slots;
+static int free_slots_count;
+static int free_slots_capacity;
+
+static inline
+unsigned addr_hash(uint64_t addr)
+{
+	return ((addr >> 4) * 0x9e3779b97f4a7c15ULL) >> (64 - addr_map_bits);
+}
+
+static
+void addr_map_alloc(int bits)
+{
+	addr_map_bits = bits;
+	addr_map = mmap(NULL, ADDR_MAP_SIZE * sizeof(*addr_map), PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr_map == MAP_FAILED) {
+		perror("mmap");
+		abort();
+	}
+}
+
+static
+void addr_map_free(struct addr_slot *map, int bits)
+{
+	if (map) {
+		munmap(map, ((size_t)1 << bits) * sizeof(*map));
+	}
+}
+
+static
+void addr_map_reset(void)
+{
+	addr_map_free(addr_map, addr_map_bits);
+	addr_map_alloc(ADDR_MAP_MIN_BITS);
+	addr_map_used = 0;
+	next_free_slot = 0;
+	free_slots_count = 0;
+}
+
+/* returns entry of addr, or empty entry where it should go */
+static
+struct addr_slot *addr_map_find(uint64_t addr)
+{
+	unsigned h = addr_hash(addr);
+	while (addr_map[h].addr && addr_map[h].addr != addr) {
+		h = (h + 1) & (ADDR_MAP_SIZE - 1);
+	}
+	return &addr_map[h];
+}
+
+static
+void addr_map_grow(void)
+{
+	struct addr_slot *old = addr_map;
+	int old_bits = addr_map_bits;
+	addr_map_alloc(addr_map_bits + 1);
+	for (size_t k = 0; k < ((size_t)1 << old_bits); k++) {
+		if (old[k].addr) {
+			*addr_map_find(old[k].addr) = old[k];
+		}
+	}
+	addr_map_free(old, old_bits);
+}
+
+static
+void push_free_slot(int slot)
+{
+	if (free_slots_count == free_slots_capacity) {
+		size_t old_size = (size_t)free_slots_capacity * sizeof(*free_slots);
+		free_slots_capacity = free_slots_capacity ? free_slots_capacity * 2 : 1024;
+		free_slots = free_slots
+			? mremap(free_slots, old_size, (size_t)free_slots_capacity * sizeof(*free_slots),
+				 MREMAP_MAYMOVE)
+			: mmap(NULL, (size_t)free_slots_capacity * sizeof(*free_slots),
+			       PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (free_slots == MAP_FAILED) {
+			perror("mmap");
+			abort();
+		}
+	}
+	free_slots[free_slots_count++] = slot;
+}
+
+static
+void addr_map_delete(struct addr_slot *e)
+{
+	unsigned hole = e - addr_map;
+	unsigned h = hole;
+	while (1) {
+		h = (h + 1) & (ADDR_MAP_SIZE - 1);
+		if (!addr_map[h].addr) {
+			break;
+		}
+		/* entry can fill the hole, if hole lies between it's home
+		 * and it's current position */
+		unsigned home = addr_hash(addr_map[h].addr);
+		if (((h - home) & (ADDR_MAP_SIZE - 1)) >= ((h - hole) & (ADDR_MAP_SIZE - 1))) {
+			addr_map[hole] = addr_map[h];
+			hole = h;
+		}
+	}
+	addr_map[hole].addr = 0;
+}
+
+/* replaces address key of event with slot. false if event has to
+ * be dropped */
+static
+bool replay_map_address(struct trace_event *e, struct replay_stats *st)
+{
+	struct addr_slot *slot = addr_map_find(e->key);
+
+	if (e->type == TRACE_FREE) {
+		if (!slot->addr) {
+			/* allocated before recording started, or by other
+			 * thread which chunk comes later */
+			st->unmatched_frees++;
+			return false;
+		}
+		e->key = slot->slot;
+		push_free_slot(slot->slot);
+		addr_map_delete(slot);
+		addr_map_used--;
+		return true;
+	}
+
+	if (!slot->addr) {
+		int k;
+		if (free_slots_count) {
+			k = free_slots[--free_slots_count];
+		} else if (next_free_slot < blobs_count) {
+			k = next_free_slot++;
+		} else {
+			st->out_of_slots++;
+			return false;
+		}
+		/* keep table at most half full */
+		if (++addr_map_used > ADDR_MAP_SIZE / 2) {
+			addr_map_grow();
+			slot = addr_map_find(e->key);
+		}
+		slot->addr = e->key;
+		slot->slot = k;
+	}
+	/* alloc of live address means we missed it's free, and it is
+	 * implicitly freed by replay */
+	e->key = slot->slot;
+	return true;
+}
+
+static
+bool replay_validate(const struct trace_event *e, struct replay_stats *st)
+{
+	if (e->key >= (uint64_t)blobs_count || e->len > UINT32_MAX) {
+		st->bad_keys++;
+		return false;
+	}
+	if (e->type != TRACE_FREE && e->len < 128) {
+		st->skipped_small++;
+		return false;
+	}
+	return true;
+}
+
+static
+void replay_open(struct replay_source *src, const char *path)
+{
+	struct stat stbuf;
+	int fd;
+
+	memset(src, 0, sizeof(*src));
+	src->reader = trace_reader_open(path);
+	if (src->reader) {
+		printf("replaying v2 trace\n");
+		src->addresses = (trace_reader_flags(src->reader) & TRACE_F_ADDRESSES) != 0;
+		if (src->addresses) {
+			addr_map_reset();
+		}
+		return;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror("open");
+		abort();
+	}
+	if (fstat(fd, &stbuf)) {
+		perror("fstat");
+		abort();
+	}
+	src->total = stbuf.st_size / sizeof(sim_evt_t);
+	if (stbuf.st_size % sizeof(sim_evt_t)) {
+		fprintf(stderr, "%s: ignoring %d trailing bytes\n",
+			path, (int)(stbuf.st_size % sizeof(sim_evt_t)));
+	}
+	if (src->total) {
+		src->map = mmap(NULL, src->total * sizeof(sim_evt_t), PROT_READ, MAP_PRIVATE, fd, 0);
+		if (src->map == MAP_FAILED) {
+			perror("mmap");
+			abort();
+		}
+		if (madvise(src->map, src->total * sizeof(sim_evt_t), MADV_SEQUENTIAL)) {
+			perror("madvise");
+		}
+	}
+	close(fd);
+}
+
+static
+void replay_close(struct replay_source *src)
+{
+	if (src->reader) {
+		trace_reader_close(src->reader);
+	} else if (src->map) {
+		munmap(src->map, src->total * sizeof(sim_evt_t));
+	}
+}
+
+/* decodes up to REPLAY_BATCH events. Returns number of ops placed
+ * into batch, sets *done at end of trace */
+static
+int replay_decode(struct replay_source *src, struct replay_op *batch,
+		  struct replay_stats *st, bool *done)
+{
+	struct trace_event e = {.type = TRACE_ALLOC};
+	int n = 0;
+	int k;
+
+	for (k = 0; k < REPLAY_BATCH; k++) {
+		if (src->reader) {
+			if (!trace_read(src->reader, &e)) {
+				break;
+			}
+		} else {
+			sim_evt_t evt;
+			if (src->offset >= src->total) {
+				break;
+			}
+			memcpy(&evt, src->map + src->offset++ * sizeof(evt), sizeof(evt));
+			/* evt.len *= 64; */
+			e.key = evt.sec;
+			e.len = evt.len;
+		}
+		if (src->addresses && !replay_map_address(&e, st)) {
+			continue;
+		}
+		if (!replay_validate(&e, st)) {
+			continue;
+		}
+		batch[n].type = e.type;
+		batch[n].key = e.key;
+		batch[n].len = e.len;
+		n++;
+	}
+	*done = k < REPLAY_BATCH;
+
+	if (src->map && (src->offset * sizeof(sim_evt_t) - src->dropped) >= REPLAY_DROP_BYTES) {
+		size_t upto = src->offset * sizeof(sim_evt_t) & ~((size_t)getpagesize() - 1);
+		madvise(src->map + src->dropped, upto - src->dropped, MADV_DONTNEED);
+		src->dropped = upto;
+	}
+	return n;
+}
+
+static
+void replay_apply(const struct replay_op *batch, int n)
+{
+	for (int k = 0; k < n; k++) {
+		uint32_t key = batch[k].key;
+		if (blobs.ptrs[key]) {
+			free_blob(blobs.ptrs[key], blobs.sizes[key]);
+			usefully_allocated -= blobs.sizes[key];
+			useful_allocations_count--;
+			blob_table_remove(&blobs, key);
+		}
+		if (batch[k].type == TRACE_FREE) {
+			continue;
+		}
+		/* no realloc hook, so realloc is just free and alloc */
+		blob_table_add_at(&blobs, key, allocate_blob(batch[k].len), batch[k].len);
+		usefully_allocated += batch[k].len;
+		useful_allocations_count++;
+	}
+}
+
+/* replays count valid events of trace, after skipping first skip
+ * of them. Returns number of events replayed */
+static
+unsigned long replay_trace(const char *path, unsigned long skip, unsigned long count)
+{
+	static struct replay_op batch[REPLAY_BATCH];
+	struct replay_stats st = {0};
+	struct replay_source src;
+	bool done = false;
+	uint64_t start;
+
+	replay_open(&src, path);
+
+	set_phase(LAT_PHASE_REPLAY);
+	start = now_ns();
+	while (!done && count) {
+		uint64_t t0, t1, t2;
+		int from = 0;
+		int n;
+		check_stop();
+		t0 = now_ns();
+		n = replay_decode(&src, batch, &st, &done);
+		if (skip) {
+			from = skip < n ? skip : n;
+			skip -= from;
+		}
+		if (n - from > count) {
+			n = from + count;
+		}
+		t1 = now_ns();
+		replay_apply(batch + from, n - from);
+		t2 = now_ns();
+		st.events += n - from;
+		count -= n - from;
+		st.decode_ns += t1 - t0;
+		st.alloc_ns += t2 - t1;
+	}
+	replay_close(&src);
+
+	{
+		uint64_t elapsed = now_ns() - start;
+		printf("replay: %lu events in %.3f s, %.0f events/sec\n"
+		       "replay: decode %.3f s, allocator %.3f s (%.0f events/sec)\n",
+		       st.events, elapsed / 1e9, elapsed ? st.events * 1e9 / elapsed : 0,
+		       st.decode_ns / 1e9, st.alloc_ns / 1e9,
+		       st.alloc_ns ? st.events * 1e9 / st.alloc_ns : 0);
+		if (st.skipped_small || st.bad_keys) {
+			printf("replay: skipped %lu small, %lu with key >= %d\n",
+			       st.skipped_small, st.bad_keys, blobs_count);
+		}
+		if (st.unmatched_frees || st.out_of_slots) {
+			printf("replay: %lu frees of unknown addresses, %lu allocs over %d live\n",
+			       st.unmatched_frees, st.out_of_slots, blobs_count);
+		}
+	}
+	return st.events;
+}
+
+static
+void do_simulate_dump(const char *path, bool dont_bump)
+{
+	stats_phase = "replay";
+	replay_trace(path, 0, ~0UL);
+	print_current_stats();
+	if (!dont_bump) {
+		bump_sizes();
+	}
+	print_current_stats();
+}
+
+/*
+ * Multi-threaded workload. Every thread runs fill/bump/free cycle on
+ * it's own partition of blobs. Given percentage of frees is handed
+ * over to random other thread, via single producer/single consumer
+ * ring per (from, to) pair of threads. Main thread only prints
+ * aggregate stats.
+ */
+
+#define XFREE_RING_SIZE 512
+#define MT_STATS_INTERVAL_MS 1000
+
+struct xfree_ring {
+	unsigned long head;
+	unsigned long tail;
+	struct {
+		void *blob;
+		size_t size;
+	} slots[XFREE_RING_SIZE];
+};
+
+struct mt_thread {
+	pthread_t thread;
+	int idx;
+	/* it's part of blob slots */
+	struct blob_table blobs;
+	struct rng rng;
+	/* written by owning thread, read by main thread */
+	size_t allocated;
+	long count;
+	unsigned long ops;
+	unsigned long cross_frees;
+} __attribute__((aligned(64)));
+
+static int mt_threads_count;
+static int mt_cross_free_percent;
+static bool mt_dont_bump;
+static struct mt_thread *mt_threads;
+/* [from * mt_threads_count + to] */
+static struct xfree_ring *xfree_rings;
+
+static
+bool xfree_push(struct xfree_ring *ring, void *blob, size_t size)
+{
+	unsigned long tail = ring->tail;
+	if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) >= XFREE_RING_SIZE) {
+		return false;
+	}
+	ring->slots[tail % XFREE_RING_SIZE].blob = blob;
+	ring->slots[tail % XFREE_RING_SIZE].size = size;
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+static
+unsigned long xfree_drain(struct xfree_ring *ring)
+{
+	unsigned long head = ring->head;
+	unsigned long tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	unsigned long drained = tail - head;
+	for (; head != tail; head++) {
+		free_blob(ring->slots[head % XFREE_RING_SIZE].blob,
+			  ring->slots[head % XFREE_RING_SIZE].size);
+	}
+	__atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+	return drained;
+}
+
+static
+void mt_publish(struct mt_thread *t, size_t allocated, long count, unsigned long ops)
+{
+	__atomic_store_n(&t->allocated, allocated, __ATOMIC_RELAXED);
+	__atomic_store_n(&t->count, count, __ATOMIC_RELAXED);
+	__atomic_store_n(&t->ops, ops, __ATOMIC_RELAXED);
+}
+
+static
+void *mt_thread_body(void *_t)
+{
+	struct mt_thread *t = _t;
+	size_t limit = fill_target / mt_threads_count;
+	size_t allocated = 0;
+	long count = 0;
+	unsigned long ops = 0;
+	struct blob_table *tab = &t->blobs;
+	/* frees 5 per mille, like single threaded workload */
+	double log_q = log1p(-0.005);
+
+	if (lat_enabled) {
+		lat_register_thread();
+	}
+	if (perf_enabled) {
+		perf_register_thread();
+	}
+
+	for (unsigned long times = 0; ; times++) {
+		set_phase(LAT_PHASE_FREE);
+		for (int from = 0; from < mt_threads_count; from++) {
+			ops += xfree_drain(&xfree_rings[from * mt_threads_count + t->idx]);
+		}
+
+		set_phase(LAT_PHASE_FILL);
+		do {
+			int slot = blob_table_free_slot(tab);
+			unsigned size;
+			if (slot < 0) {
+				fprintf(stderr, "too successful allocation!\n");
+				abort();
+			}
+			if (size_dists_count) {
+				uint32_t r1 = rng_u31(&t->rng);
+				uint32_t r2 = rng_u31(&t->rng);
+				size = mixed_size(times, r1, r2, rng_u31(&t->rng));
+			} else {
+				size = minimal_size + rng_below(&t->rng, size_range);
+			}
+			blob_table_add_at(tab, slot, allocate_blob(size), size);
+			allocated += size;
+			count++;
+			ops++;
+		} while (allocated < limit);
+
+		if (!mt_dont_bump && (times % 100000) == 0) {
+			ops += bump_range(tab, &allocated, &count, limit);
+		}
+
+		set_phase(LAT_PHASE_FREE);
+		for (long i = tab->live - 1 - (long)rng_geometric(&t->rng, log_q); i >= 0;
+		     i -= 1 + (long)rng_geometric(&t->rng, log_q)) {
+			int k = blob_table_live_slot(tab, i);
+			allocated -= tab->sizes[k];
+			count--;
+			ops++;
+			if (mt_threads_count > 1
+			    && (int)rng_below(&t->rng, 100) < mt_cross_free_percent) {
+				int to = rng_below(&t->rng, mt_threads_count - 1);
+				if (to >= t->idx) {
+					to++;
+				}
+				if (xfree_push(&xfree_rings[t->idx * mt_threads_count + to],
+					       tab->ptrs[k], tab->sizes[k])) {
+					__atomic_store_n(&t->cross_frees, t->cross_frees + 1, __ATOMIC_RELAXED);
+					blob_table_remove(tab, k);
+					continue;
+				}
+			}
+			free_blob(tab->ptrs[k], tab->sizes[k]);
+			blob_table_remove(tab, k);
+		}
+
+		mt_publish(t, allocated, count, ops);
+	}
+	return NULL;
+}
+
+static
+void run_mt_workload(unsigned seed)
+{
+	int part = blobs_count / mt_threads_count;
+	unsigned long last_ops = 0;
+	uint64_t start = now_ns();
+	uint64_t last = start;
+	int error;
+
+	serialize_allocs = !main_fns->thread_safe;
+	printf("threads = %d\ncross_free_percent = %d\nserialized = %d\n",
+	       mt_threads_count, mt_cross_free_percent, (int)serialize_allocs);
+
+	mt_threads = calloc(mt_threads_count, sizeof(*mt_threads));
+	xfree_rings = calloc((size_t)mt_threads_count * mt_threads_count, sizeof(*xfree_rings));
+	if (!mt_threads || !xfree_rings) {
+		perror("calloc");
+		abort();
+	}
+
+	for (int k = 0; k < mt_threads_count; k++) {
+		struct mt_thread *t = &mt_threads[k];
+		t->idx = k;
+		blob_table_init(&t->blobs, part);
+		rng_seed(&t->rng, seed, k + 1);
+		error = pthread_create(&t->thread, NULL, mt_thread_body, t);
+		if (error) {
+			errno = error;
+			perror("pthread_create");
+			abort();
+		}
+	}
+
+	while (1) {
+		struct timespec ts = {.tv_sec = MT_STATS_INTERVAL_MS / 1000,
+				      .tv_nsec = (MT_STATS_INTERVAL_MS % 1000) * 1000000L};
+		unsigned long ops = 0;
+		unsigned long cross_frees = 0;
+		bool all_published = true;
+		uint64_t now;
+
+		nanosleep(&ts, NULL);
+		now = now_ns();
+
+		usefully_allocated = 0;
+		useful_allocations_count = 0;
+		for (int k = 0; k < mt_threads_count; k++) {
+			struct mt_thread *t = &mt_threads[k];
+			unsigned long thread_ops = __atomic_load_n(&t->ops, __ATOMIC_RELAXED);
+			usefully_allocated += __atomic_load_n(&t->allocated, __ATOMIC_RELAXED);
+			useful_allocations_count += __atomic_load_n(&t->count, __ATOMIC_RELAXED);
+			ops += thread_ops;
+			cross_frees += __atomic_load_n(&t->cross_frees, __ATOMIC_RELAXED);
+			all_published = all_published && thread_ops;
+		}
+
+		/* until every thread finished it's first fill, waste
+		 * numbers are meaningless */
+		if (!all_published) {
+			continue;
+		}
+
+		stats_phase = "mt";
+		stats_ops = ops;
+		stats_ops_per_sec = (ops - last_ops) * 1e9 / (now - last);
+		printf("mt stats (%.1f s):\n", (now - start) / 1e9);
+		printf("ops/sec: %.0f\ntotal ops: %lu\ncross frees: %lu\n",
+		       (ops - last_ops) * 1e9 / (now - last), ops, cross_frees);
+		print_current_stats();
+		if (frag_log_path) {
+			frag_log_sample(ops, 0, false);
+		}
+		printf("\n\n");
+		fflush(stdout);
+		last_ops = ops;
+		last = now;
+	}
+}
+
+/*
+ * Benchmark mode. Runs random workload for fixed number of
+ * operations (every alloc and every free is one operation), first
+ * warmup_ops without timing, then given number of timed
+ * repetitions. Random is seeded identically for every allocator, so
+ * all of them see same sequence of sizes.
+ */
+
+#define MAX_BENCH_REPS 1000
+
+struct bench_result {
+	double mean;
+	double ci;
+	double min;
+	double max;
+	float waste;
+	size_t rss;
+};
+
+static unsigned long bench_iterations;
+
+/* runs fill/free iterations of random workload until at least count
+ * operations are done. Returns number of operations */
+static
+unsigned long run_random_ops(unsigned long count, bool dont_bump)
+{
+	unsigned long ops = 0;
+	while (ops < count) {
+		check_stop();
+		if (!random_fill(&ops)) {
+			fprintf(stderr, "too successful allocation!\n");
+			abort();
+		}
+		if (!dont_bump && (bench_iterations % 100000) == 0) {
+			ops += bump_sizes();
+		}
+		bench_iterations++;
+		random_free(5, &ops);
+	}
+	return ops;
+}
+
+/* two-sided 95% quantile of student's t distribution */
+static
+double t_95(int df)
+{
+	static const double table[] = {
+		12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+		2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+		2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+	};
+	if (df <= (int)(sizeof(table) / sizeof(table[0]))) {
+		return table[df - 1];
+	}
+	return 1.960;
+}
+
+static
+void run_bench(unsigned seed, unsigned long bench_ops, unsigned long warmup_ops,
+	       int reps, bool dont_bump, struct bench_result *res)
+{
+	double rates[MAX_BENCH_REPS];
+	double sum = 0, sq = 0;
+	size_t total_ram;
+	int k;
+
+	rng_seed(&workload_rng, seed, 0);
+	bench_iterations = 0;
+	run_random_ops(warmup_ops, dont_bump);
+	if (perf_enabled) {
+		perf_reset(thread_blob_ops);
+	}
+
+	res->min = res->max = 0;
+	for (k = 0; k < reps; k++) {
+		unsigned long frag_next = frag_log_next;
+		uint64_t start, end;
+		unsigned long ops;
+		frag_log_next = ULONG_MAX;
+		start = now_ns();
+		ops = run_random_ops(bench_ops, dont_bump);
+		end = now_ns();
+		if (frag_next != ULONG_MAX) {
+			frag_log_next = frag_next;
+			frag_log_sample(thread_blob_ops, thread_blob_allocs, true);
+		}
+		rates[k] = ops * 1e9 / (end - start);
+		printf("rep %d: %lu ops in %.3f s, %.0f ops/sec\n",
+		       k, ops, (end - start) / 1e9, rates[k]);
+		sum += rates[k];
+		if (!k || rates[k] < res->min) {
+			res->min = rates[k];
+		}
+		if (rates[k] > res->max) {
+			res->max = rates[k];
+		}
+	}
+
+	res->mean = sum / reps;
+	for (k = 0; k < reps; k++) {
+		sq += (rates[k] - res->mean) * (rates[k] - res->mean);
+	}
+	res->ci = reps > 1 ? t_95(reps - 1) * sqrt(sq / (reps - 1)) / sqrt(reps) : 0;
+
+	total_ram = get_total_allocated_size();
+	res->waste = (float)((double)total_ram - usefully_allocated) * 100 / total_ram;
+	res->rss = rss_allocated();
+
+	stats_phase = "bench";
+	stats_ops_per_sec = res->mean;
+	print_current_stats();
+}
 
 static
-void *allocate_blob(unsigned size)
+void print_bench_result(const char *name, const struct bench_result *res)
 {
-	return main_fns->alloc(size);
+	printf("%-20s %12.0f %10.0f %12.0f %12.0f %8.2f\n",
+	       name, res->mean, res->ci, res->min, res->max, res->waste);
 }
 
 static
-void free_blob(void *blob, size_t size)
+void print_bench_header(void)
 {
-	main_fns->free(blob, size);
+	printf("%-20s %12s %10s %12s %12s %8s\n",
+	       "allocator", "ops/sec", "+-95%", "min", "max", "waste %");
 }
 
 static
-size_t get_total_allocated_size(void)
+void setup_stack(allocation_functions *fns, bool chunky)
 {
-	return main_fns->get_total_allocated_size();
+	if (chunky) {
+		chunky_slave_fns = fns;
+		chunky_fns.thread_safe = chunky_slave_fns->thread_safe;
+		main_fns = &chunky_fns;
+	} else {
+		main_fns = fns;
+	}
 }
 
-#define ALLOCATE_UNTIL_MB ((1200 + 15) / 16 * 16 - 1)
+static
+void stack_name(char *buf, size_t len)
+{
+	if (main_fns == &chunky_fns) {
+		snprintf(buf, len, "%s:%s",
+			 chunky_batch && chunky_slave_fns->alloc_batch ? "chunky-batch" : "chunky",
+			 chunky_slave_fns->name);
+	} else {
+		snprintf(buf, len, "%s", main_fns->name);
+	}
+}
+
+static int parse_int(int *place, char *arg, int min, int max);
+
+static
+allocation_functions *find_allocator(const char *name)
+{
+	if (strcmp(name, "dl") == 0) {
+		return &dl_fns;
+	} else if (strcmp(name, "dlms") == 0) {
+		return &dl_mspace_fns;
+	} else if (strcmp(name, "mini") == 0) {
+		return &mini_fns;
+	} else if (strcmp(name, "je") == 0) {
+		return &jemalloc_fns;
+	} else if (strcmp(name, "buddy") == 0) {
+		return &buddy_fns;
+	}
+	return NULL;
+}
 
-static int usefully_allocated;
-static int useful_allocations_count;
+/*
+ * Sweep runs benchmark for every combination of allocators, chunky
+ * wrapping, minimal_size and size_range, each in it's own child
+ * process pinned to it's own cpu. Number of concurrent children is
+ * bounded by cpus we're allowed to run on and by available memory.
+ */
 
-float max_waste;
+#define MAX_SWEEP_VALUES 32
+
+static allocation_functions *sweep_fns[MAX_SWEEP_VALUES];
+static int sweep_fns_count;
+static int sweep_chunky[2];
+static int sweep_chunky_count;
+static int sweep_min_sizes[MAX_SWEEP_VALUES];
+static int sweep_min_sizes_count;
+static int sweep_ranges[MAX_SWEEP_VALUES];
+static int sweep_ranges_count;
+/* -N, children size their own blob table for their sizes */
+static int sweep_blobs;
+
+struct sweep_point {
+	allocation_functions *fns;
+	bool chunky;
+	int minimal_size;
+	int size_range;
+	char name[64];
+	struct bench_result res;
+	bool ok;
+	pid_t pid;
+	int fd;
+	int cpu;
+};
 
 static
-void print_current_stats(void)
+int parse_int_list(char *list, int *out, int max_count, int min, int max)
 {
-	int total_ram = get_total_allocated_size();
-	float waste = (float)(total_ram - usefully_allocated) * 100 / total_ram;
-	if (waste > max_waste) {
-		max_waste = waste;
+	int count = 0;
+	for (char *w = strtok(list, ","); w; w = strtok(NULL, ",")) {
+		if (count == max_count || !parse_int(&out[count], w, min, max)) {
+			return 0;
+		}
+		count++;
 	}
-	printf("got from OS: %d\nApp allocated: %d\nAllocations count:%d\nwaste %f %f %%\n",
-	       total_ram,
-	       usefully_allocated,
-	       useful_allocations_count,
-	       waste, max_waste);
+	return count;
 }
 
-#define BLOBS_COUNT (1024*1024)
+static
+void sweep_all_allocators(void)
+{
+	static allocation_functions *const all_fns[] = {
+		&dl_fns, &dl_mspace_fns, &mini_fns, &jemalloc_fns, &buddy_fns
+	};
+	sweep_fns_count = sizeof(all_fns) / sizeof(all_fns[0]);
+	memcpy(sweep_fns, all_fns, sizeof(all_fns));
+}
 
-void *blobs[BLOBS_COUNT];
-size_t sizes[BLOBS_COUNT];
+/* spec is list of key=value,value,... separated by spaces or
+ * semicolons. Keys are t (allocators or all), c (0 or 1), m
+ * (minimal_size) and r (size_range) */
+static
+int parse_sweep(char *spec)
+{
+	char *save;
+	for (char *item = strtok_r(spec, " ;", &save); item; item = strtok_r(NULL, " ;", &save)) {
+		char *values = strchr(item, '=');
+		if (!values || values - item != 1) {
+			return 0;
+		}
+		values++;
+		switch (item[0]) {
+		case 't':
+			sweep_fns_count = 0;
+			for (char *w = strtok(values, ","); w; w = strtok(NULL, ",")) {
+				if (strcmp(w, "all") == 0) {
+					sweep_all_allocators();
+					continue;
+				}
+				if (sweep_fns_count == MAX_SWEEP_VALUES
+				    || !(sweep_fns[sweep_fns_count++] = find_allocator(w))) {
+					return 0;
+				}
+			}
+			if (!sweep_fns_count) {
+				return 0;
+			}
+			break;
+		case 'c':
+			sweep_chunky_count = parse_int_list(values, sweep_chunky, 2, 0, 1);
+			if (!sweep_chunky_count) {
+				return 0;
+			}
+			break;
+		case 'm':
+			sweep_min_sizes_count = parse_int_list(values, sweep_min_sizes,
+							       MAX_SWEEP_VALUES, 128, 2*1024*1024);
+			if (!sweep_min_sizes_count) {
+				return 0;
+			}
+			break;
+		case 'r':
+			sweep_ranges_count = parse_int_list(values, sweep_ranges,
+							    MAX_SWEEP_VALUES, 1, 20*1024*1024);
+			if (!sweep_ranges_count) {
+				return 0;
+			}
+			break;
+		default:
+			return 0;
+		}
+	}
+	return 1;
+}
 
-int minimal_size = 128;
-int size_range = 65536;
+static
+size_t mem_available(void)
+{
+	char line[256];
+	size_t rv = 0;
+	FILE *f = fopen("/proc/meminfo", "r");
+	if (f) {
+		while (fgets(line, sizeof(line), f)) {
+			unsigned long kb;
+			if (sscanf(line, "MemAvailable: %lu kB", &kb) == 1) {
+				rv = (size_t)kb << 10;
+				break;
+			}
+		}
+		fclose(f);
+	}
+	if (!rv) {
+		rv = (size_t)sysconf(_SC_AVPHYS_PAGES) * sysconf(_SC_PAGESIZE);
+	}
+	return rv;
+}
 
 static
-void bump_sizes(void)
+void sweep_start(struct sweep_point *pt, unsigned seed, unsigned long bench_ops,
+		 unsigned long warmup_ops, int reps, bool dont_bump, bool quiet)
 {
-	for (int k = 0; k < BLOBS_COUNT; k++) {
-		if (!blobs[k] || sizes[k] > (minimal_size + size_range / 2)) {
-			continue;
+	int fds[2];
+
+	if (pipe(fds)) {
+		perror("pipe");
+		abort();
+	}
+	fflush(stdout);
+	pt->pid = fork();
+	if (pt->pid < 0) {
+		perror("fork");
+		abort();
+	}
+	if (pt->pid == 0) {
+		cpu_set_t set;
+		close(fds[0]);
+		memsample_init();
+		if (quiet && !freopen("/dev/null", "w", stdout)) {
+			perror("freopen");
+			_exit(1);
 		}
-		unsigned old_size = sizes[k];
-		unsigned new_size = old_size + (old_size >> 8);
-		if (new_size > minimal_size + size_range) {
-			new_size = minimal_size + size_range;
+		CPU_ZERO(&set);
+		CPU_SET(pt->cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set)) {
+			perror("sched_setaffinity");
 		}
-		if (new_size == old_size) {
-			continue;
+		minimal_size = pt->minimal_size;
+		size_range = pt->size_range;
+		setup_stack(pt->fns, pt->chunky);
+		stack_name(stack_label, sizeof(stack_label));
+		setup_sizes();
+		setup_blob_table(sweep_blobs);
+		frag_log_begin(true);
+		if (perf_enabled) {
+			perf_register_thread();
 		}
-		free_blob(blobs[k], sizes[k]);
-		blobs[k] = 0;
-		usefully_allocated -= old_size;
-		useful_allocations_count--;
-		if (usefully_allocated < (ALLOCATE_UNTIL_MB * 1048576)) {
-			blobs[k] = allocate_blob(new_size);
-			sizes[k] = new_size;
-			usefully_allocated += new_size;
-			useful_allocations_count++;
+		run_bench(seed, bench_ops, warmup_ops, reps, dont_bump, &pt->res);
+		fflush(stdout);
+		if (write(fds[1], &pt->res, sizeof(pt->res)) != sizeof(pt->res)) {
+			perror("write");
+			_exit(1);
 		}
+		_exit(0);
 	}
+	close(fds[1]);
+	pt->fd = fds[0];
 }
 
 static
-void do_simulate_dump(const char *path, bool dont_bump)
+void run_sweep(unsigned seed, unsigned long bench_ops, unsigned long warmup_ops,
+	       int reps, bool dont_bump, int jobs)
 {
-	typedef struct {
-		uint32_t sec;
-		uint32_t len;
-	} sim_evt_t;
-	sim_evt_t evt;
-	FILE *f;
-	f = fopen(path, "rb");
-	if (!f) {
-		perror("fopen");
+	int count = sweep_fns_count * sweep_chunky_count * sweep_min_sizes_count * sweep_ranges_count;
+	struct sweep_point *points = calloc(count, sizeof(*points));
+	size_t per_child = fill_target + fill_target / 4
+		+ (size_t)blobs_count * (sizeof(*blobs.ptrs) + sizeof(*blobs.sizes)
+					 + sizeof(*blobs.order) + sizeof(*blobs.pos));
+	int cpus[CPU_SETSIZE];
+	bool cpu_busy[CPU_SETSIZE] = {false};
+	int cpus_count = 0;
+	int next = 0, running = 0;
+	cpu_set_t set;
+	int k;
+
+	if (!points) {
+		perror("calloc");
 		abort();
 	}
-	while (!feof(f)) {
-		int rv = fread(&evt, sizeof(evt), 1, f);
-		if (rv != 1) {
-			if (rv == 0) {
-				break;
-			}
-			perror("fread");
+	k = 0;
+	for (int a = 0; a < sweep_fns_count; a++)
+		for (int c = 0; c < sweep_chunky_count; c++)
+			for (int m = 0; m < sweep_min_sizes_count; m++)
+				for (int r = 0; r < sweep_ranges_count; r++) {
+					struct sweep_point *pt = &points[k++];
+					pt->fns = sweep_fns[a];
+					pt->chunky = sweep_chunky[c];
+					pt->minimal_size = sweep_min_sizes[m];
+					pt->size_range = sweep_ranges[r];
+					setup_stack(pt->fns, pt->chunky);
+					stack_name(pt->name, sizeof(pt->name));
+				}
+
+	if (sched_getaffinity(0, sizeof(set), &set)) {
+		perror("sched_getaffinity");
+		abort();
+	}
+	for (k = 0; k < CPU_SETSIZE; k++) {
+		if (CPU_ISSET(k, &set)) {
+			cpus[cpus_count++] = k;
+		}
+	}
+	if (!jobs) {
+		size_t by_mem = mem_available() / per_child;
+		jobs = cpus_count;
+		if (by_mem < jobs) {
+			jobs = by_mem ? by_mem : 1;
+		}
+	}
+	if (jobs > cpus_count) {
+		jobs = cpus_count;
+	}
+	printf("sweep: %d configurations, %d at a time\n", count, jobs);
+
+	while (next < count || running) {
+		int status;
+		pid_t pid;
+
+		while (running < jobs && next < count) {
+			struct sweep_point *pt = &points[next++];
+			for (k = 0; cpu_busy[k]; k++)
+				;
+			cpu_busy[k] = true;
+			pt->cpu = cpus[k];
+			printf("\n%s -m %d -r %d on cpu %d:\n",
+			       pt->name, pt->minimal_size, pt->size_range, pt->cpu);
+			sweep_start(pt, seed, bench_ops, warmup_ops, reps, dont_bump, jobs > 1);
+			running++;
+		}
+
+		pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			perror("waitpid");
 			abort();
 		}
-		/* evt.len *= 64; */
-		if (evt.len < 128) {
+		for (k = 0; k < next && points[k].pid != pid; k++)
+			;
+		if (k == next) {
 			continue;
 		}
-		if (blobs[evt.sec]) {
-			free_blob(blobs[evt.sec], sizes[evt.sec]);
-			usefully_allocated -= sizes[evt.sec];
-			/* fprintf(stderr, "overwritten sec: %llu\n", (unsigned long long)evt.sec); */
-			useful_allocations_count--;
+		{
+			struct sweep_point *pt = &points[k];
+			pt->ok = read(pt->fd, &pt->res, sizeof(pt->res)) == sizeof(pt->res)
+				&& WIFEXITED(status) && WEXITSTATUS(status) == 0;
+			close(pt->fd);
+			for (k = 0; cpus[k] != pt->cpu; k++)
+				;
+			cpu_busy[k] = false;
+			running--;
 		}
-		sizes[evt.sec] = evt.len;
-		blobs[evt.sec] = allocate_blob(evt.len);
-		usefully_allocated += evt.len;
-		useful_allocations_count++;
 	}
-	print_current_stats();
-	if (!dont_bump) {
-		bump_sizes();
+
+	printf("\nbenchmark: %lu ops x %d reps, warmup %lu ops, seed 0x%08x\n",
+	       bench_ops, reps, warmup_ops, seed);
+	printf("%-20s %8s %8s %12s %10s %12s %12s %8s %8s\n",
+	       "allocator", "min", "range", "ops/sec", "+-95%", "min", "max", "waste %", "rss mb");
+	for (k = 0; k < count; k++) {
+		struct sweep_point *pt = &points[k];
+		printf("%-20s %8d %8d ", pt->name, pt->minimal_size, pt->size_range);
+		if (pt->ok) {
+			printf("%12.0f %10.0f %12.0f %12.0f %8.2f %8zu\n",
+			       pt->res.mean, pt->res.ci, pt->res.min, pt->res.max,
+			       pt->res.waste, pt->res.rss >> 20);
+		} else {
+			printf("failed\n");
+		}
+	}
+	free(points);
+}
+
+static
+void scenario_fill(unsigned long *ops)
+{
+	if (!random_fill(ops)) {
+		fprintf(stderr, "too successful allocation!\n");
+		abort();
+	}
+}
+
+static
+void run_phase(const struct scenario_phase *ph, unsigned long *ops)
+{
+	switch (ph->type) {
+	case PHASE_FILL:
+		fill_target = ph->value * 1048576;
+		scenario_fill(ops);
+		break;
+	case PHASE_CHURN:
+		for (unsigned long k = 0; k < ph->a; k++) {
+			check_stop();
+			scenario_fill(ops);
+			random_free(ph->b, ops);
+		}
+		break;
+	case PHASE_GROW:
+		fill_target = fill_target * ph->value;
+		scenario_fill(ops);
+		break;
+	case PHASE_SHRINK:
+		fill_target /= ph->value;
+		random_free_down_to(fill_target, ops);
+		break;
+	case PHASE_SIZES_UNIFORM:
+		minimal_size = ph->a;
+		size_range = ph->b;
+		size_dists_count = 0;
+		setup_sizes();
+		break;
+	case PHASE_SIZES_HISTO:
+		memcpy(size_dists, ph->dists, ph->dists_count * sizeof(ph->dists[0]));
+		size_dists_count = ph->dists_count;
+		size_mix_period = ph->mix_period;
+		setup_sizes();
+		break;
+	case PHASE_FREE:
+		/* per mille granularity, like churn */
+		random_free(ph->value * 10, ops);
+		break;
+	case PHASE_BUMP:
+		*ops += bump_sizes();
+		break;
+	case PHASE_REPLAY:
+		*ops += replay_trace(ph->path, ph->a, ph->b);
+		break;
+	}
+}
+
+static
+void run_scenario(const struct scenario *sc)
+{
+	for (int k = 0; k < sc->count; k++) {
+		const struct scenario_phase *ph = &sc->phases[k];
+		unsigned long ops = 0;
+		uint64_t start, elapsed, sampling;
+
+		printf("phase %d: %s\n", k, ph->text);
+		fflush(stdout);
+		stats_phase = ph->text;
+		sampling = frag_log_spent_ns;
+		start = now_ns();
+		run_phase(ph, &ops);
+		elapsed = now_ns() - start - (frag_log_spent_ns - sampling);
+		stats_ops_per_sec = elapsed ? ops * 1e9 / elapsed : 0;
+		printf("phase %d done in %.3f s, %lu ops (%.0f ops/sec)\n",
+		       k, elapsed / 1e9, ops, elapsed ? ops * 1e9 / elapsed : 0);
+		print_current_stats();
+		printf("\n\n");
+		fflush(stdout);
 	}
-	print_current_stats();
 }
 
 static
@@ -150,15 +1922,58 @@ static
 void usage_and_exit(int argc, char **argv)
 {
 	fprintf(stderr,
-		"usage: %s [-m minimal_size] [-r size_range] [-c] [-b]"
-		"[-t allocator] [-n]\n"
+		"usage: %s [-m minimal_size] [-r size_range] [-a heap_mb] [-N blobs] [-c [-A]] [-b]"
+		"[-t allocator] [-n] [-g max_chunk_mb] [-P heap_file] [-k trials]"
+		"[-C budget_kb] [-S rate_kb [-I idle_ms] [-L rss_log]]"
+		"[-s sample_ms] [-T threads [-X cross_free_percent]] [-H]"
+		"[-B ops [-w warmup_ops] [-R reps]] [-e seed] [-D histogram [-M mix_period]]"
+		"[-f scenario] [-W sweep [-j jobs]] [-o csv:file|json:file] [-F prefault]"
+		"[-l frag_log [-i ops]] [-E]\n"
 		"\n"
+		"  -a random workload fills heap up to heap_mb (default %d)\n"
+		"  -N size of blob table (default by heap_mb and mean size, at least %d)\n"
 		"  -b dont do bumps\n"
 		"  -c wrap with chunky allocator\n"
+		"  -A with -c, allocate and free blob's chunks in one batch call if allocator\n"
+		"     can (with dl that is dlindependent_comalloc, so chunks are contiguous)\n"
+		"  -C compact heap every 1000 iterations moving at most budget_kb\n"
+		"  -S release free memory in background at rate_kb per second\n"
+		"  -I only release after idle_ms without allocations (default 0)\n"
+		"  -L log rss over time to rss_log\n"
+		"  -s sample rss, pss and faults in background every sample_ms\n"
+		"  -T run random workload in given number of threads\n"
+		"  -X percentage of frees done by other thread (default 0)\n"
+		"  -H record alloc/free latency histograms\n"
+		"  -E count cycles, instructions, cache and dTLB misses and page faults\n"
+		"     per op of every phase (see perf-counters.h)\n"
+		"  -F who faults heap pages in: touch (every allocation, default), populate\n"
+		"     (allocator's regions as it gets them) or none (see prefault.h)\n"
+		"  -g grow mini chunks geometrically up to max_chunk_mb\n"
+		"  -d replay simple_dump or v2 trace (dump-convert, malloc-recorder.so)\n"
+		"  -k replay dump given number of times resetting heap in between\n"
 		"  -n randomize rnd\n"
+		"  -e seed rnd with given value\n"
+		"  -D draw random sizes from histogram file (like sample_sr_data_histo.txt)\n"
+		"     given several times, distribution drifts from one to next\n"
+		"  -M fill iterations to drift between histograms (default 10000)\n"
+		"  -f run phases described in scenario file (see scenario.h)\n"
+		"  -W benchmark (-B) every combination of e.g. \"t=dl,mini c=0,1 m=128 r=4096,65536\"\n"
+		"     in parallel child processes, each pinned to it's own cpu\n"
+		"  -j children to run at once (default by cpus and available memory)\n"
+		"  -l append fragmentation samples to binary frag_log (see frag-log.h,\n"
+		"     frag-log-read)\n"
+		"  -i allocs and frees between fragmentation samples (default 100000)\n"
+		"  -o append every stats sample to file as csv row or json line (see stats-out.h)\n"
+		"  -B benchmark throughput of given number of operations\n"
+		"  -w untimed operations before benchmark (default same as -B)\n"
+		"  -R benchmark repetitions (default 5)\n"
+		"  -P keep mini heap and it's live blobs in heap_file (reattached if exists).\n"
+		"     SIGINT/SIGTERM stop cleanly; file of killed run can't be reattached\n"
+		"     and has to be removed\n"
 		"\n"
-		"Supported allocator types: dl, mini, je, buddy\n",
-		argv[0]);
+		"Supported allocator types: dl, dlms, mini, je, buddy\n"
+		"and, with -B only, all (every allocator, plain and with -c)\n",
+		argv[0], ALLOCATE_UNTIL_MB, MIN_BLOBS_COUNT);
 	exit(1);
 }
 
@@ -171,52 +1986,215 @@ int main(int argc, char **argv)
 	bool dont_bump = false;
 	bool use_chunky = false;
 	bool randomize = false;
+	int max_chunk_mb = 0;
+	int trials = 1;
+	int compact_budget_kb = 0;
+	int scavenge_rate_kb = 0;
+	int scavenge_idle_ms = 0;
+	const char *rss_log = NULL;
+	int sample_ms = 0;
 	const char *read_dump = NULL;
 	const char *dump_first_path = NULL;
+	const char *scenario_path = NULL;
+	int bench_ops = 0;
+	int warmup_ops = -1;
+	int bench_reps = 5;
+	int fixed_seed = -1;
+	bool all_stacks = false;
+	char *sweep_spec = NULL;
+	int jobs = 0;
+	int heap_mb = 0;
+	int blobs_arg = 0;
+	int frag_interval;
 
-	while ((i = getopt(argc, argv, "bcd:m:np:r:t:")) != -1) {
+	stats_start_ns = now_ns();
+
+	while ((i = getopt(argc, argv, "Aa:bB:cC:d:D:e:Ef:F:g:Hi:I:j:k:l:L:m:M:nN:o:p:P:r:R:s:S:t:T:w:W:X:")) != -1) {
 		switch (i) {
+		case 'a':
+			if (!parse_int(&heap_mb, optarg, 1, INT32_MAX)) {
+				fprintf(stderr, "invalid heap_mb\n");
+				usage_and_exit(argc, argv);
+			}
+			fill_target = (size_t)heap_mb << 20;
+			break;
 		case 'b':
 			dont_bump = true;
 			break;
+		case 'A':
+			chunky_batch = true;
+			break;
+		case 'B':
+			if (!parse_int(&bench_ops, optarg, 1, INT32_MAX)) {
+				fprintf(stderr, "invalid ops\n");
+				usage_and_exit(argc, argv);
+			}
+			break;
 		case 'c':
 			use_chunky = true;
 			break;
+		case 'C':
+			if (!parse_int(&compact_budget_kb, optarg, 1, 1024*1024)) {
+				fprintf(stderr, "invalid budget_kb\n");
+				usage_and_exit(argc, argv);
+			}
+			compact_budget = (size_t)compact_budget_kb << 10;
+			break;
 		case 'd':
 			read_dump = optarg;
 			break;
+		case 'D':
+			if (size_dists_count == MAX_SIZE_DISTS) {
+				fprintf(stderr, "too many size histograms\n");
+				usage_and_exit(argc, argv);
+			}
+			size_dists[size_dists_count++] = size_dist_load(optarg);
+			break;
+		case 'e':
+			if (!parse_int(&fixed_seed, optarg, 0, INT32_MAX)) {
+				fprintf(stderr, "invalid seed\n");
+				usage_and_exit(argc, argv);
+			}
+			break;
+		case 'E':
+			perf_enabled = true;
+			break;
+		case 'f':
+			scenario_path = optarg;
+			break;
+		case 'F':
+			if (!prefault_set_policy(optarg)) {
+				fprintf(stderr, "invalid prefault policy: %s\n", optarg);
+				usage_and_exit(argc, argv);
+			}
+			break;
+		case 'g':
+			if (!parse_int(&max_chunk_mb, optarg, 2, 64*1024)) {
+				fprintf(stderr, "invalid max_chunk_mb\n");
+				usage_and_exit(argc, argv);
+			}
+			mini_max_chunk_size = (size_t)max_chunk_mb << 20;
+			break;
+		case 'H':
+			lat_enabled = true;
+			break;
+		case 'i':
+			if (!parse_int(&frag_interval, optarg, 1, INT32_MAX)) {
+				fprintf(stderr, "invalid sample interval\n");
+				usage_and_exit(argc, argv);
+			}
+			frag_log_interval = frag_interval;
+			break;
+		case 'l':
+			frag_log_path = optarg;
+			break;
+		case 'I':
+			if (!parse_int(&scavenge_idle_ms, optarg, 0, 3600*1000)) {
+				fprintf(stderr, "invalid idle_ms\n");
+				usage_and_exit(argc, argv);
+			}
+			break;
+		case 'L':
+			rss_log = optarg;
+			break;
+		case 'R':
+			if (!parse_int(&bench_reps, optarg, 1, MAX_BENCH_REPS)) {
+				fprintf(stderr, "invalid reps\n");
+				usage_and_exit(argc, argv);
+			}
+			break;
+		case 's':
+			if (!parse_int(&sample_ms, optarg, 1, 3600*1000)) {
+				fprintf(stderr, "invalid sample_ms\n");
+				usage_and_exit(argc, argv);
+			}
+			break;
+		case 'S':
+			if (!parse_int(&scavenge_rate_kb, optarg, 1, 64*1024*1024)) {
+				fprintf(stderr, "invalid rate_kb\n");
+				usage_and_exit(argc, argv);
+			}
+			break;
+		case 'k':
+			if (!parse_int(&trials, optarg, 1, 1000000)) {
+				fprintf(stderr, "invalid trials\n");
+				usage_and_exit(argc, argv);
+			}
+			break;
 		case 'm':
 			if (!parse_int(&minimal_size, optarg, 128, 2*1024*1024)) {
 				fprintf(stderr, "invalid minimal_size\n");
 				return 1;
 			}
 			break;
+		case 'M':
+			if (!parse_int(&size_mix_period, optarg, 1, INT32_MAX)) {
+				fprintf(stderr, "invalid mix_period\n");
+				usage_and_exit(argc, argv);
+			}
+			break;
 		case 'n':
 			randomize = true;
 			break;
+		case 'N':
+			if (!parse_int(&blobs_arg, optarg, 1024, INT32_MAX)) {
+				fprintf(stderr, "invalid blobs\n");
+				usage_and_exit(argc, argv);
+			}
+			break;
+		case 'o':
+			if (!stats_out_open(optarg)) {
+				fprintf(stderr, "invalid stats output: %s\n", optarg);
+				usage_and_exit(argc, argv);
+			}
+			break;
 		case 'p':
 			dump_first_path = optarg;
 			break;
+		case 'P':
+			mini_persist_path = optarg;
+			break;
 		case 'r':
 			if (!parse_int(&size_range, optarg, 1, 20*1024*1024)) {
 				fprintf(stderr, "invalid size_range\n");
 				usage_and_exit(argc, argv);
 			}
 			break;
+		case 'T':
+			if (!parse_int(&mt_threads_count, optarg, 1, 1024)) {
+				fprintf(stderr, "invalid threads\n");
+				usage_and_exit(argc, argv);
+			}
+			break;
+		case 'w':
+			if (!parse_int(&warmup_ops, optarg, 0, INT32_MAX)) {
+				fprintf(stderr, "invalid warmup_ops\n");
+				usage_and_exit(argc, argv);
+			}
+			break;
+		case 'X':
+			if (!parse_int(&mt_cross_free_percent, optarg, 0, 100)) {
+				fprintf(stderr, "invalid cross_free_percent\n");
+				usage_and_exit(argc, argv);
+			}
+			break;
 		case 't':
-			if (strcmp(optarg, "dl") == 0) {
-				main_fns = &dl_fns;
-			} else if (strcmp(optarg, "mini") == 0) {
-				main_fns = &mini_fns;
-			} else if (strcmp(optarg, "je") == 0) {
-				main_fns = &jemalloc_fns;
-			} else if (strcmp(optarg, "buddy") == 0) {
-				main_fns = &buddy_fns;
-			} else {
+			if (strcmp(optarg, "all") == 0) {
+				all_stacks = true;
+			} else if (!(main_fns = find_allocator(optarg))) {
 				fprintf(stderr, "invalid type: %s\n", optarg);
 				usage_and_exit(argc, argv);
 			}
 			break;
+		case 'W':
+			sweep_spec = optarg;
+			break;
+		case 'j':
+			if (!parse_int(&jobs, optarg, 1, CPU_SETSIZE)) {
+				fprintf(stderr, "invalid jobs\n");
+				usage_and_exit(argc, argv);
+			}
+			break;
 		case '?':
 			fprintf(stderr, "invalid option\n");
 			usage_and_exit(argc, argv);
@@ -225,52 +2203,183 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (use_chunky) {
-		chunky_slave_fns = main_fns;
-		main_fns = &chunky_fns;
-		printf("name = chunky:%s\n", chunky_slave_fns->name);
+	if (scenario_path && (mt_threads_count || all_stacks || sweep_spec || bench_ops || read_dump)) {
+		fprintf(stderr, "-f can't be combined with -T, -t all, -W, -B or -d\n");
+		usage_and_exit(argc, argv);
+	}
+
+	if (mt_threads_count && scavenge_rate_kb) {
+		fprintf(stderr, "-S can't be combined with -T\n");
+		usage_and_exit(argc, argv);
+	}
+
+	/* replay and benchmark are single threaded */
+	if (mt_threads_count && (bench_ops || read_dump)) {
+		fprintf(stderr, "-T can't be combined with -B or -d\n");
+		usage_and_exit(argc, argv);
+	}
+
+	if (all_stacks || sweep_spec) {
+		if (!bench_ops || sample_ms || scavenge_rate_kb) {
+			fprintf(stderr, "-t all and -W need -B and can't be combined with -s or -S\n");
+			usage_and_exit(argc, argv);
+		}
+		sweep_fns[0] = main_fns;
+		sweep_fns_count = 1;
+		sweep_chunky[0] = use_chunky;
+		sweep_chunky_count = 1;
+		sweep_min_sizes[0] = minimal_size;
+		sweep_min_sizes_count = 1;
+		sweep_ranges[0] = size_range;
+		sweep_ranges_count = 1;
+		sweep_blobs = blobs_arg;
+		if (all_stacks) {
+			/* every allocator, plain and chunky, one by one */
+			sweep_all_allocators();
+			sweep_chunky[1] = !use_chunky;
+			sweep_chunky_count = 2;
+			if (!jobs) {
+				jobs = 1;
+			}
+		}
+		if (sweep_spec && !parse_sweep(sweep_spec)) {
+			fprintf(stderr, "invalid sweep: %s\n", sweep_spec);
+			usage_and_exit(argc, argv);
+		}
+		printf("name = sweep\n");
 	} else {
-		printf("name = %s\n", main_fns->name);
+		setup_stack(main_fns, use_chunky);
+		stack_name(stack_label, sizeof(stack_label));
+		printf("name = %s\n", stack_label);
+	}
+
+	/* only random workload of main thread compacts */
+	if (compact_budget && (bench_ops || mt_threads_count || scenario_path || read_dump)) {
+		fprintf(stderr, "-C can't be combined with -B, -T, -f or -d\n");
+		usage_and_exit(argc, argv);
+	}
+
+	if (compact_budget && !main_fns->compact) {
+		fprintf(stderr, "%s doesn't support compaction\n", main_fns->name);
+		return 1;
+	}
+
+	if (mini_persist_path
+	    && (main_fns != &mini_fns || mt_threads_count || all_stacks || sweep_spec)) {
+		fprintf(stderr, "-P needs -t mini without -c and can't be combined with -T, -W or -t all\n");
+		usage_and_exit(argc, argv);
 	}
 
+	printf("prefault = %s\n", prefault_policy_name());
 	printf("minimal_size = %d\n", minimal_size);
 	printf("size_range = %d\n", size_range);
+	memsample_init();
+	setup_sizes();
+	setup_blob_table(blobs_arg);
+	printf("heap_mb = %zu\n", fill_target >> 20);
+	printf("blobs = %d\n", blobs_count);
+	if (max_chunk_mb) {
+		printf("max_chunk_mb = %d\n", max_chunk_mb);
+	}
+
+	if (sample_ms) {
+		memsample_start(sample_ms);
+	}
+
+	if (scavenge_rate_kb) {
+		struct scavenger_config cfg = {
+			.rate = (size_t)scavenge_rate_kb << 10,
+			.idle_ms = scavenge_idle_ms,
+			.log_path = rss_log
+		};
+		printf("scavenger: %d kb/s after %d ms idle\n", scavenge_rate_kb, scavenge_idle_ms);
+		scavenger_start(&cfg);
+	}
+
+	if (mini_persist_path) {
+		attach_persistent_heap();
+	}
+
+	if (!all_stacks && !sweep_spec) {
+		frag_log_begin(!mt_threads_count);
+		/* multi-threaded workload counts in it's threads */
+		if (perf_enabled && !mt_threads_count) {
+			perf_register_thread();
+		}
+	}
 
 	if (read_dump) {
-		do_simulate_dump(read_dump, dont_bump);
+		if (blobs.live) {
+			/* trace's keys are slots of blob table */
+			printf("dropping restored blobs before replay\n");
+			reset_heap();
+		}
+		for (i = 0; i < trials; i++) {
+			if (i) {
+				reset_heap();
+				printf("\ntrial %d:\n", i);
+			}
+			do_simulate_dump(read_dump, dont_bump);
+		}
+		scavenger_stop();
+		memsample_stop();
 		return 0;
 	}
 
-	if (randomize) {
+	unsigned seed = 0;
+	if (fixed_seed >= 0) {
+		seed = fixed_seed;
+		printf("seeded random with: 0x%08x\n", seed);
+	} else if (randomize) {
 		struct timeval tv;
-		unsigned seed;
 		rv = gettimeofday(&tv, 0);
 		if (rv) {
 			perror("gettimeofday");
 			abort();
 		}
 		seed = (unsigned)tv.tv_sec ^ (unsigned)tv.tv_usec ^ (unsigned)getpid();
-		srandom((unsigned)seed);
 		printf("seeded random with: 0x%08x\n", seed);
-	} else {
-		srandom(0);
 	}
+	rng_seed(&workload_rng, seed, 0);
 
-	for (int times = 100000000; times >= 0; times--) {
-		for (i = 0; i < BLOBS_COUNT; i++) {
-			if (blobs[i]) {
-				continue;
-			}
-			unsigned size = minimal_size + random() % size_range;
-			blobs[i] = allocate_blob(size);
-			sizes[i] = size;
-			usefully_allocated += size;
-			useful_allocations_count++;
-			if (usefully_allocated >= (ALLOCATE_UNTIL_MB * 1048576))
-				break;
+	if (scenario_path) {
+		run_scenario(scenario_load(scenario_path));
+		scavenger_stop();
+		memsample_stop();
+		return 0;
+	}
+
+	if (bench_ops) {
+		if (warmup_ops < 0) {
+			warmup_ops = bench_ops;
+		}
+		if (all_stacks || sweep_spec) {
+			run_sweep(seed, bench_ops, warmup_ops, bench_reps, dont_bump, jobs);
+		} else {
+			struct bench_result res;
+			run_bench(seed, bench_ops, warmup_ops, bench_reps, dont_bump, &res);
+			printf("\nbenchmark: %d ops x %d reps, warmup %d ops, seed 0x%08x\n",
+			       bench_ops, bench_reps, warmup_ops, seed);
+			print_bench_header();
+			print_bench_result(stack_label, &res);
 		}
+		scavenger_stop();
+		memsample_stop();
+		return 0;
+	}
+
+	if (mt_threads_count) {
+		mt_dont_bump = dont_bump;
+		run_mt_workload(seed);
+		scavenger_stop();
+		memsample_stop();
+		return 0;
+	}
 
-		if (i >= BLOBS_COUNT) {
+	for (int times = 100000000; times >= 0; times--) {
+		unsigned long ops = 0;
+		check_stop();
+		if (!random_fill(&ops)) {
 			fprintf(stderr, "too successful allocation!\n");
 			return 1;
 		}
@@ -286,16 +2395,17 @@ int main(int argc, char **argv)
 		if ((times % 100000) == 0) {
 			printf("stats (%d):\n", times);
 			print_current_stats();
+			if (compact_budget) {
+				printf("compaction: released %zu moved %zu\n",
+				       compact_released, compact_moved);
+			}
 			printf("\n\n");
 		}
 
-		for (; i >= 0; i--) {
-			if (blobs[i] && random() % 1000 < 5) {
-				usefully_allocated -= sizes[i];
-				useful_allocations_count--;
-				free_blob(blobs[i], sizes[i]);
-				blobs[i] = 0;
-			}
+		random_free(5, &ops);
+
+		if (compact_budget && (times % COMPACT_INTERVAL) == 0) {
+			compact_heap();
 		}
 	}
 
@@ -303,34 +2413,6 @@ int main(int argc, char **argv)
 }
 
 
-void *touch_pages(void *_p, size_t size)
-{
-	char *p = _p;
-	char *pend = p + size;
-	do {
-		*p = 0;
-		p += ((~(uintptr_t)p) & 4095) + 1;
-	} while (p < pend);
-	return _p;
-}
-
-size_t rss_allocated(void)
-{
-	unsigned long long dummy, rss_pages = 0;
-	FILE *sm = fopen("/proc/self/statm", "r");
-	if (!sm) {
-		perror("fopen(\"/proc/self/statm\")");
-		abort();
-	}
-	fscanf(sm, "%llu %llu", &dummy, &rss_pages);
-	if (rss_pages == 0) {
-		perror("fscanf");
-		abort();
-	}
-	fclose(sm);
-	return (size_t)rss_pages * 4096;
-}
-
 static FILE *diagnose_file;
 
 static
@@ -343,15 +2425,19 @@ static
 void dump_chunks(const char *path)
 {
 	int i;
+	if (main_fns->iterate_heap) {
+		diagnose_file = fopen(path, "w");
+		main_fns->iterate_heap(NULL, diagnose_cb);
+		fclose(diagnose_file);
+		return;
+	}
 	if (!main_fns->iterate_chunks) {
 		return;
 	}
 	diagnose_file = fopen(path, "w");
-	for (i = 0; i < BLOBS_COUNT; i++) {
-		if (!blobs[i]) {
-			continue;
-		}
-		main_fns->iterate_chunks(blobs[i], sizes[i], NULL, diagnose_cb);
+	for (i = 0; i < blobs.live; i++) {
+		int k = blob_table_live_slot(&blobs, i);
+		main_fns->iterate_chunks(blobs.ptrs[k], blobs.sizes[k], NULL, diagnose_cb);
 	}
 	fclose(diagnose_file);
 }
@@ -0,0 +1,336 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "trace.h"
+
+/*
+ * LD_PRELOAD-able recorder of malloc family calls. Writes v2 trace
+ * (chunked, keys are addresses) into $MALLOC_RECORD_PATH, or
+ * malloc-record.<pid>.trace by default. Replay it with -d.
+ *
+ * Every thread encodes events into it's own buffer, which is
+ * appended to file as single chunk by one write() when full, on
+ * thread exit and at process exit. Buffers are mmap-ed on thread's
+ * first event (only pointer is in static TLS, which glibc carves out
+ * of every thread's stack), and go to free list on thread exit for
+ * next threads. They are never unmapped, since exit flush may still
+ * look at them. Recording itself takes no locks and never
+ * allocates. Real allocations are done via glibc's
+ * __libc_* entry points, so we don't need dlsym (which allocates).
+ *
+ * Realloc that moves block is recorded as free and alloc.
+ */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+extern void __libc_free(void *p);
+extern void *__libc_memalign(size_t align, size_t size);
+
+#define REC_BUF_SIZE (64 << 10)
+#define MAX_REC_THREADS 4096
+
+#define REC_FLAGS (TRACE_F_TIMESTAMPS | TRACE_F_THREADS | TRACE_F_CHUNKED | TRACE_F_ADDRESSES)
+
+enum {
+	BUF_IDLE,
+	BUF_BUSY,
+	/* taken over by exit flush, no more recording */
+	BUF_CLOSED
+};
+
+struct rec_buf {
+	int state;
+	struct rec_buf *next_free;
+	uint32_t thread;
+	struct trace_codec codec;
+	uint32_t pos;
+	unsigned char data[REC_BUF_SIZE];
+};
+
+#define TLS __thread __attribute__((tls_model("initial-exec")))
+
+static TLS struct rec_buf *thread_buf;
+/* set even if buffer couldn't be mapped, not to retry every event */
+static TLS bool thread_registered;
+
+static int rec_fd = -1;
+static uint32_t next_thread;
+static pthread_key_t exit_key;
+static struct rec_buf *all_bufs[MAX_REC_THREADS];
+/* buffers of exited threads */
+static struct rec_buf *free_bufs;
+static int free_bufs_lock;
+
+static
+void lock_free_bufs(void)
+{
+	while (__atomic_exchange_n(&free_bufs_lock, 1, __ATOMIC_ACQUIRE)) {
+		;
+	}
+}
+
+static
+void unlock_free_bufs(void)
+{
+	__atomic_store_n(&free_bufs_lock, 0, __ATOMIC_RELEASE);
+}
+
+static
+struct rec_buf *new_buf(void)
+{
+	struct rec_buf *b;
+	lock_free_bufs();
+	b = free_bufs;
+	if (b) {
+		free_bufs = b->next_free;
+	}
+	unlock_free_bufs();
+	if (b) {
+		return b;
+	}
+	b = mmap(NULL, sizeof(*b), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return b == MAP_FAILED ? NULL : b;
+}
+
+static
+void write_all(const void *_p, size_t len)
+{
+	const char *p = _p;
+	while (len) {
+		ssize_t rv = write(rec_fd, p, len);
+		if (rv < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			/* nothing sane to do inside malloc. Stop recording */
+			rec_fd = -1;
+			return;
+		}
+		p += rv;
+		len -= rv;
+	}
+}
+
+/* data starts with room for chunk length */
+static
+void flush_buf(struct rec_buf *b)
+{
+	uint32_t len = b->pos - sizeof(len);
+	if (len && rec_fd >= 0) {
+		memcpy(b->data, &len, sizeof(len));
+		/* O_APPEND makes every chunk land in one piece */
+		write_all(b->data, b->pos);
+	}
+	b->pos = sizeof(len);
+	trace_codec_reset(&b->codec);
+}
+
+static
+void thread_exit(void *_b)
+{
+	struct rec_buf *b = _b;
+	int idle = BUF_IDLE;
+	bool flushed = __atomic_compare_exchange_n(&b->state, &idle, BUF_BUSY, false,
+						   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+	if (flushed) {
+		flush_buf(b);
+		__atomic_store_n(&b->state, BUF_IDLE, __ATOMIC_RELEASE);
+	}
+	all_bufs[b->thread] = NULL;
+	thread_buf = NULL;
+	if (!flushed) {
+		/* recording is over */
+		return;
+	}
+	lock_free_bufs();
+	b->next_free = free_bufs;
+	free_bufs = b;
+	unlock_free_bufs();
+}
+
+static
+struct rec_buf *get_buf(void)
+{
+	struct rec_buf *b = thread_buf;
+	if (!thread_registered) {
+		thread_registered = true;
+		b = thread_buf = new_buf();
+		if (!b) {
+			return NULL;
+		}
+		b->thread = __atomic_fetch_add(&next_thread, 1, __ATOMIC_RELAXED);
+		b->codec.flags = REC_FLAGS;
+		b->pos = sizeof(uint32_t);
+		if (b->thread < MAX_REC_THREADS) {
+			__atomic_store_n(&all_bufs[b->thread], b, __ATOMIC_RELEASE);
+			/* no allocation for keys below PTHREAD_KEY_2NDLEVEL_SIZE */
+			pthread_setspecific(exit_key, b);
+		}
+	}
+	return b;
+}
+
+static
+void record(enum trace_event_type type, void *p, size_t len)
+{
+	struct trace_event e;
+	struct timespec ts;
+	struct rec_buf *b;
+	int idle = BUF_IDLE;
+
+	if (rec_fd < 0 || !p) {
+		return;
+	}
+	b = get_buf();
+	if (!b || !__atomic_compare_exchange_n(&b->state, &idle, BUF_BUSY, false,
+					 __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	e.type = type;
+	e.key = (uintptr_t)p;
+	e.len = len;
+	e.timestamp = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	e.thread = b->thread;
+	if (b->pos + TRACE_MAX_EVENT_BYTES > REC_BUF_SIZE) {
+		flush_buf(b);
+	}
+	b->pos += trace_encode(&b->codec, &e, b->data + b->pos);
+	__atomic_store_n(&b->state, BUF_IDLE, __ATOMIC_RELEASE);
+}
+
+static __attribute__((constructor))
+void recorder_init(void)
+{
+	char default_path[64];
+	const char *path = getenv("MALLOC_RECORD_PATH");
+	struct trace_header h;
+
+	if (!path) {
+		snprintf(default_path, sizeof(default_path), "malloc-record.%d.trace", (int)getpid());
+		path = default_path;
+	}
+	if (pthread_key_create(&exit_key, thread_exit)) {
+		return;
+	}
+	rec_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+	if (rec_fd < 0) {
+		return;
+	}
+	trace_header_init(&h, REC_FLAGS);
+	write_all(&h, sizeof(h));
+}
+
+/* flushes every thread's buffer. Threads that are still running
+ * stop recording */
+static __attribute__((destructor))
+void recorder_fini(void)
+{
+	uint32_t count = __atomic_load_n(&next_thread, __ATOMIC_RELAXED);
+	if (count > MAX_REC_THREADS) {
+		count = MAX_REC_THREADS;
+	}
+	for (uint32_t k = 0; k < count; k++) {
+		struct rec_buf *b = __atomic_load_n(&all_bufs[k], __ATOMIC_ACQUIRE);
+		int idle = BUF_IDLE;
+		if (!b) {
+			continue;
+		}
+		while (!__atomic_compare_exchange_n(&b->state, &idle, BUF_CLOSED, false,
+						    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			if (idle == BUF_CLOSED) {
+				break;
+			}
+			idle = BUF_IDLE;
+		}
+		if (idle != BUF_CLOSED) {
+			flush_buf(b);
+		}
+	}
+	if (rec_fd >= 0) {
+		close(rec_fd);
+		rec_fd = -1;
+	}
+}
+
+void *malloc(size_t size)
+{
+	void *rv = __libc_malloc(size);
+	record(TRACE_ALLOC, rv, size);
+	return rv;
+}
+
+void *calloc(size_t n, size_t size)
+{
+	void *rv = __libc_calloc(n, size);
+	record(TRACE_ALLOC, rv, n * size);
+	return rv;
+}
+
+void *realloc(void *p, size_t size)
+{
+	void *rv = __libc_realloc(p, size);
+	if (!p) {
+		record(TRACE_ALLOC, rv, size);
+	} else if (!size) {
+		record(TRACE_FREE, p, 0);
+	} else if (rv == p) {
+		record(TRACE_REALLOC, rv, size);
+	} else if (rv) {
+		record(TRACE_FREE, p, 0);
+		record(TRACE_ALLOC, rv, size);
+	}
+	return rv;
+}
+
+void free(void *p)
+{
+	record(TRACE_FREE, p, 0);
+	__libc_free(p);
+}
+
+void *memalign(size_t align, size_t size)
+{
+	void *rv = __libc_memalign(align, size);
+	record(TRACE_ALLOC, rv, size);
+	return rv;
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+	return memalign(align, size);
+}
+
+int posix_memalign(void **out, size_t align, size_t size)
+{
+	void *rv;
+	if (align < sizeof(void *) || (align & (align - 1))) {
+		return EINVAL;
+	}
+	rv = memalign(align, size);
+	if (!rv) {
+		return ENOMEM;
+	}
+	*out = rv;
+	return 0;
+}
+
+void *valloc(size_t size)
+{
+	return memalign(getpagesize(), size);
+}
+
+void *pvalloc(size_t size)
+{
+	size_t page = getpagesize();
+	return memalign(page, (size + page - 1) & ~(page - 1));
+}
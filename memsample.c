@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <sys/resource.h>
+#include "common.h"
+#include "memsample.h"
+#include "blob-table.h"
+
+static int statm_fd = -1;
+static int smaps_fd = -1;
+static long page_size;
+
+static pthread_t thread;
+static volatile bool running;
+static volatile bool stopping;
+static unsigned interval;
+
+/* published by sampling thread */
+static size_t sampled_rss;
+static size_t sampled_pss;
+static long sampled_minflt;
+static long sampled_majflt;
+
+static
+int open_proc(const char *path)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		perror(path);
+		abort();
+	}
+	return fd;
+}
+
+static
+size_t read_rss(void)
+{
+	char buf[128];
+	unsigned long long dummy, rss_pages = 0;
+	ssize_t len;
+
+	len = pread(statm_fd, buf, sizeof(buf) - 1, 0);
+	if (len <= 0) {
+		perror("pread(\"/proc/self/statm\")");
+		abort();
+	}
+	buf[len] = 0;
+	if (sscanf(buf, "%llu %llu", &dummy, &rss_pages) != 2 || rss_pages == 0) {
+		fprintf(stderr, "can't parse /proc/self/statm\n");
+		abort();
+	}
+	return (size_t)rss_pages * page_size;
+}
+
+/* smaps_rollup is quite expensive (walks all vmas), so it's only read
+ * by sampling thread */
+static
+size_t read_pss(void)
+{
+	char buf[4096];
+	char *p;
+	ssize_t len;
+
+	if (smaps_fd < 0) {
+		smaps_fd = open("/proc/self/smaps_rollup", O_RDONLY | O_CLOEXEC);
+		if (smaps_fd < 0) {
+			return 0;
+		}
+	}
+	len = pread(smaps_fd, buf, sizeof(buf) - 1, 0);
+	if (len <= 0) {
+		return 0;
+	}
+	buf[len] = 0;
+	p = strstr(buf, "\nPss:");
+	if (!p) {
+		return 0;
+	}
+	return (size_t)strtoull(p + 5, NULL, 10) << 10;
+}
+
+void memsample_init(void)
+{
+	if (statm_fd >= 0) {
+		close(statm_fd);
+	}
+	if (smaps_fd >= 0) {
+		close(smaps_fd);
+		smaps_fd = -1;
+	}
+	statm_fd = open_proc("/proc/self/statm");
+	page_size = sysconf(_SC_PAGESIZE);
+}
+
+static
+void read_faults(long *minflt, long *majflt)
+{
+	struct rusage ru;
+	if (getrusage(RUSAGE_SELF, &ru)) {
+		perror("getrusage");
+		abort();
+	}
+	*minflt = ru.ru_minflt;
+	*majflt = ru.ru_majflt;
+}
+
+static
+void *sampler_thread(void *dummy)
+{
+	while (!stopping) {
+		struct timespec ts = {.tv_sec = interval / 1000,
+				      .tv_nsec = (interval % 1000) * 1000000L};
+		long minflt, majflt;
+		size_t rss = read_rss();
+		size_t pss = read_pss();
+		read_faults(&minflt, &majflt);
+		__atomic_store_n(&sampled_rss, rss, __ATOMIC_RELAXED);
+		__atomic_store_n(&sampled_pss, pss, __ATOMIC_RELAXED);
+		__atomic_store_n(&sampled_minflt, minflt, __ATOMIC_RELAXED);
+		__atomic_store_n(&sampled_majflt, majflt, __ATOMIC_RELAXED);
+		nanosleep(&ts, NULL);
+	}
+	return NULL;
+}
+
+void memsample_start(unsigned interval_ms)
+{
+	int error;
+	interval = interval_ms;
+	/* publish first sample before anyone can look at it */
+	sampled_rss = read_rss();
+	sampled_pss = read_pss();
+	read_faults(&sampled_minflt, &sampled_majflt);
+	error = pthread_create(&thread, NULL, sampler_thread, NULL);
+	if (error) {
+		errno = error;
+		perror("pthread_create");
+		abort();
+	}
+	running = true;
+}
+
+void memsample_stop(void)
+{
+	if (!running) {
+		return;
+	}
+	stopping = true;
+	pthread_join(thread, NULL);
+	running = false;
+	stopping = false;
+}
+
+void memsample_get(struct mem_sample *sample)
+{
+	if (running) {
+		sample->rss = __atomic_load_n(&sampled_rss, __ATOMIC_RELAXED);
+		sample->pss = __atomic_load_n(&sampled_pss, __ATOMIC_RELAXED);
+		sample->minflt = __atomic_load_n(&sampled_minflt, __ATOMIC_RELAXED);
+		sample->majflt = __atomic_load_n(&sampled_majflt, __ATOMIC_RELAXED);
+		return;
+	}
+	sample->rss = read_rss();
+	sample->pss = 0;
+	read_faults(&sample->minflt, &sample->majflt);
+}
+
+/* without harness' blob tables */
+size_t rss_allocated(void)
+{
+	size_t rss = running ? __atomic_load_n(&sampled_rss, __ATOMIC_RELAXED) : read_rss();
+	size_t tables = blob_tables_resident();
+	return rss > tables ? rss - tables : 0;
+}
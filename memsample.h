@@ -0,0 +1,27 @@
+#ifndef MEMSAMPLE_H
+#define MEMSAMPLE_H
+#include <sys/types.h>
+
+/*
+ * Memory sampler. Without sampling thread every probe is single
+ * pread of /proc/self/statm (fd is kept open). With sampling thread
+ * running, it reads RSS, PSS and page fault counts every interval_ms
+ * and publishes them, so probes are just few loads.
+ */
+struct mem_sample {
+	size_t rss;
+	/* only filled by sampling thread, 0 otherwise */
+	size_t pss;
+	long minflt;
+	long majflt;
+};
+
+/* opens /proc/self/statm. Must be called before any thread that
+ * probes memory (sampler, scavenger, workers) is started, and again
+ * in forked children, since /proc/self is resolved at open */
+extern void memsample_init(void);
+extern void memsample_start(unsigned interval_ms);
+extern void memsample_stop(void);
+extern void memsample_get(struct mem_sample *sample);
+
+#endif
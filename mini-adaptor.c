@@ -1,25 +1,107 @@
+#include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <assert.h>
+#include <sys/mman.h>
 
 #include "minimalloc.h"
 #include "common.h"
+#include "prefault.h"
 
 
 static struct mini_state *ms;
+static int persist_reattached;
 __attribute__((used))
 static size_t total_allocated;
 
+/* 0 means fixed 4 megs chunks, see mini_init_geometric */
+size_t mini_max_chunk_size;
+/* if set, heap lives in this file and is reattached if file already
+ * has heap, see mini_persist_open */
+const char *mini_persist_path;
+
+/* file is sparse, so this is only upper bound */
+#define MINI_PERSIST_SIZE ((size_t)16 << 30)
+
+#define HUGE_PAGE_SIZE (2*1024*1024)
+
+/* geometric chunks are multiples of 2 megs. Align them as well so
+ * that THP can actually back them */
+static
+void *mi_huge_mallocer(size_t size)
+{
+	void *rv;
+	int error = posix_memalign(&rv, HUGE_PAGE_SIZE, size);
+	if (error) {
+		errno = error;
+		perror("posix_memalign");
+		return 0;
+	}
+	madvise(rv, size, MADV_HUGEPAGE);
+	return prefault_region(rv, size);
+}
+
+static
+void *mi_mallocer(size_t size)
+{
+	return prefault_region(malloc(size), size);
+}
+
+static
+void mi_persist_close(void)
+{
+	mini_persist_close(ms);
+}
+
+static
+void mi_persist_open(void)
+{
+	ms = mini_persist_open(mini_persist_path, MINI_PERSIST_DEFAULT_BASE,
+			       MINI_PERSIST_SIZE, &persist_reattached);
+	if (!ms && errno == EUCLEAN) {
+		fprintf(stderr, "%s was not closed cleanly (process was killed?). "
+			"It's heap can't be trusted, remove it to start over\n",
+			mini_persist_path);
+		exit(1);
+	}
+	if (!ms) {
+		perror("mini_persist_open");
+		abort();
+	}
+	printf("%s persistent heap %s (%zu bytes used)\n",
+	       persist_reattached ? "reattached" : "created",
+	       mini_persist_path, mini_persist_used());
+	atexit(mi_persist_close);
+}
+
+void **mini_attach_persistent(bool *reattached)
+{
+	if (!mini_persist_path) {
+		return 0;
+	}
+	if (!ms) {
+		mi_persist_open();
+	}
+	*reattached = persist_reattached;
+	return mini_persist_root();
+}
+
 static
 void *mi_alloc(size_t size)
 {
 	if (!ms) {
-		ms = mini_init(malloc, 0);
+		if (mini_persist_path)
+			mi_persist_open();
+		else if (mini_max_chunk_size)
+			ms = mini_init_geometric(mi_huge_mallocer, free, mini_max_chunk_size);
+		else
+			ms = mini_init(mi_mallocer, free);
 		if (!ms) {
 			abort();
 		}
 	}
 	void *rv = mini_malloc(ms, size);
-	touch_pages(rv, size);
+	prefault_alloc(rv, size);
 	total_allocated += size;
 	return rv;
 }
@@ -39,10 +121,66 @@ size_t mi_get_total_allocated_size(void)
 	return rss_allocated();
 }
 
+static
+bool mi_reset(void)
+{
+	if (ms) {
+		mini_reset(ms, 0);
+	}
+	total_allocated = 0;
+	return true;
+}
+
+static
+size_t mi_compact(size_t budget,
+		  void (*relocate)(void *old_p, void *new_p, void *data),
+		  void *data)
+{
+	if (!ms) {
+		return 0;
+	}
+	return mini_compact(ms, budget, relocate, data);
+}
+
+static
+size_t mi_release_free_memory(size_t budget)
+{
+	if (!ms) {
+		return 0;
+	}
+	return mini_purge(ms, budget);
+}
+
+struct free_state {
+	void *data;
+	void (*cb)(size_t size, size_t count, void *data);
+};
+
+static
+void mi_span_cb(void *span_start, size_t span_size, void *cb_data)
+{
+	struct free_state *st = cb_data;
+	st->cb(span_size, 1, st->data);
+}
+
+static
+void mi_iterate_free(void *data, void (*cb)(size_t size, size_t count, void *data))
+{
+	struct free_state st = {.data = data, .cb = cb};
+	struct mini_stats stats;
+	if (ms) {
+		mini_get_stats(ms, &stats, mi_span_cb, &st);
+	}
+}
+
 allocation_functions mini_fns = {
 	.name = ".mini",
 	.alloc = mi_alloc,
 	.free = mi_free,
-	.get_total_allocated_size = mi_get_total_allocated_size
+	.get_total_allocated_size = mi_get_total_allocated_size,
+	.reset = mi_reset,
+	.compact = mi_compact,
+	.release_free_memory = mi_release_free_memory,
+	.iterate_free = mi_iterate_free
 };
 
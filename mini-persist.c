@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "minimalloc.h"
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+#define PERSIST_MAGIC 0x6d696e6970657273ULL /* "minipers" */
+/* 2: mini_state got purge_advice */
+#define PERSIST_VERSION 2
+#define PERSIST_ALIGN 4096
+
+/*
+ * Lives at start of file (and thus at base address). Chunks are
+ * carved sequentially after it.
+ */
+struct persist_header {
+	uint64_t magic;
+	uint32_t version;
+	/* set while heap is mapped, cleared by mini_persist_close. We
+	 * refuse to reattach heap that was not closed properly since
+	 * process could have died in the middle of malloc/free */
+	uint32_t dirty;
+	void *base;
+	size_t size;
+	size_t used;
+	struct mini_state *state;
+	void *root;
+};
+
+static struct persist_header *hdr;
+static int persist_fd = -1;
+
+static
+void *persist_mallocer(size_t size)
+{
+	char *rv;
+	size = (size + PERSIST_ALIGN - 1) & ~(size_t)(PERSIST_ALIGN - 1);
+	if (hdr->size - hdr->used < size) {
+		return 0;
+	}
+	rv = (char *)hdr + hdr->used;
+	hdr->used += size;
+	return rv;
+}
+
+/* chunks are never given back to file */
+static
+void persist_freer(void *p)
+{
+}
+
+/* len is passed in rather than read from header, which is only
+ * trusted once heap is fully opened */
+static
+void persist_unmap(size_t len)
+{
+	munmap(hdr, len);
+	close(persist_fd);
+	hdr = 0;
+	persist_fd = -1;
+}
+
+struct mini_state *mini_persist_open(const char *path, void *base,
+				     size_t size, int *reattached)
+{
+	struct stat st;
+	void *addr;
+	int created = 0;
+
+	if (hdr) {
+		errno = EBUSY;
+		return 0;
+	}
+
+	persist_fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (persist_fd < 0) {
+		return 0;
+	}
+	if (fstat(persist_fd, &st)) {
+		goto out_close;
+	}
+	/* file of heap which failed to get created is truncated back
+	 * to 0 on every error path below */
+	created = (st.st_size == 0);
+	if (created) {
+		size = (size + PERSIST_ALIGN - 1) & ~(size_t)(PERSIST_ALIGN - 1);
+		if (ftruncate(persist_fd, size)) {
+			goto out_close;
+		}
+	} else {
+		size = st.st_size;
+		if (size < sizeof(struct persist_header)) {
+			errno = EINVAL;
+			goto out_close;
+		}
+	}
+
+	addr = mmap(base, size, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_FIXED_NOREPLACE | MAP_NORESERVE, persist_fd, 0);
+	if (addr == MAP_FAILED) {
+		goto out_close;
+	}
+	hdr = addr;
+	if (addr != base) {
+		/* older kernels treat MAP_FIXED_NOREPLACE as hint */
+		errno = EEXIST;
+		goto out_unmap;
+	}
+
+	if (created) {
+		hdr->version = PERSIST_VERSION;
+		hdr->base = base;
+		hdr->size = size;
+		hdr->used = (sizeof(struct persist_header) + PERSIST_ALIGN - 1)
+			& ~(size_t)(PERSIST_ALIGN - 1);
+		hdr->root = 0;
+		hdr->state = mini_init(persist_mallocer, persist_freer);
+		if (!hdr->state) {
+			/* no magic yet, and empty file is created again
+			 * by next open */
+			errno = ENOSPC;
+			goto out_unmap;
+		}
+		/* only complete heap gets magic */
+		hdr->magic = PERSIST_MAGIC;
+	} else {
+		if (hdr->magic != PERSIST_MAGIC
+		    || hdr->version != PERSIST_VERSION
+		    || hdr->base != base
+		    || hdr->size != size) {
+			errno = EINVAL;
+			goto out_unmap;
+		}
+		if (hdr->dirty) {
+			errno = EUCLEAN;
+			goto out_unmap;
+		}
+		mini_rebind(hdr->state, persist_mallocer, persist_freer);
+	}
+
+	/* chunks are MAP_SHARED file pages */
+	mini_set_purge_advice(hdr->state, MADV_REMOVE);
+	hdr->dirty = 1;
+	if (reattached) {
+		*reattached = !created;
+	}
+	return hdr->state;
+
+out_unmap:
+	/* before truncating, so that nothing touches pages past end of
+	 * file */
+	munmap(addr, size);
+	hdr = 0;
+out_close:
+	{
+		int saved_errno = errno;
+		if (created && ftruncate(persist_fd, 0)) {
+			perror("ftruncate");
+		}
+		close(persist_fd);
+		persist_fd = -1;
+		errno = saved_errno;
+	}
+	return 0;
+}
+
+void mini_persist_close(struct mini_state *st)
+{
+	if (!hdr || hdr->state != st) {
+		abort();
+	}
+	msync(hdr, hdr->used, MS_SYNC);
+	hdr->dirty = 0;
+	msync(hdr, PERSIST_ALIGN, MS_SYNC);
+	persist_unmap(hdr->size);
+}
+
+void **mini_persist_root(void)
+{
+	return hdr ? &hdr->root : 0;
+}
+
+size_t mini_persist_used(void)
+{
+	return hdr ? hdr->used : 0;
+}
@@ -3,6 +3,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <bsd/sys/tree.h>
 #include <assert.h>
 
@@ -12,11 +13,26 @@ struct free_span;
 
 RB_HEAD(mini_rb, free_span);
 
+/* every chunk except first (which starts with mini_state) begins
+ * with this header */
+struct mini_chunk {
+	struct mini_chunk *next;
+	size_t size;
+};
+
 struct mini_state {
 	mini_mallocer mallocer;
 	mini_freer freer;
 	struct mini_rb head;
-	void **next_chunk;
+	struct mini_chunk *next_chunk;
+	size_t first_chunk_size;
+	/* total bytes we got from mallocer */
+	size_t chunks_size;
+	/* 0 means fixed CHUNK_SIZE chunks, otherwise new chunks are
+	 * sized geometrically (see next_chunk_size) up to this cap */
+	size_t max_chunk_size;
+	/* madvise advice mini_purge and mini_reset give pages back with */
+	int purge_advice;
 };
 
 struct free_span {
@@ -28,7 +44,11 @@ struct free_span {
 
 #define SPAN_SIZE_FREE_MASK (~(((size_t)-1) >> 1))
 #define SPAN_SIZE_PREV_FREE_MASK (SPAN_SIZE_FREE_MASK >> 1)
-#define SPAN_SIZE_VALUE_MASK (SPAN_SIZE_PREV_FREE_MASK - 1)
+/* free span's pages were given back to OS by mini_purge. Spans
+ * created by coalescing or splitting don't have it, so they may be
+ * purged again. That's cheap for already purged pages */
+#define SPAN_SIZE_PURGED_MASK (SPAN_SIZE_PREV_FREE_MASK >> 1)
+#define SPAN_SIZE_VALUE_MASK (SPAN_SIZE_PURGED_MASK - 1)
 
 static inline
 int mini_rb_cmp(struct free_span *a, struct free_span *b)
@@ -65,7 +85,22 @@ int mini_rb_cmp(struct free_span *a, struct free_span *b)
 RB_PROTOTYPE_STATIC(mini_rb, free_span, rb_link, mini_rb_cmp);
 RB_GENERATE_STATIC(mini_rb, free_span, rb_link, mini_rb_cmp);
 
+/* layout of first chunk */
+struct initial_stuff {
+	struct mini_state state;
+	struct free_span first_span;
+};
+
+/* layout of all other chunks */
+struct next_stuff {
+	struct mini_chunk chunk;
+	struct free_span first_span;
+};
+
 #define CHUNK_SIZE (4*1024*1024)
+/* geometric chunks are multiples of huge page size so that THP can
+ * back them */
+#define CHUNK_ALIGN (2*1024*1024)
 
 static inline
 size_t min_size(size_t a, size_t b)
@@ -79,6 +114,26 @@ size_t max_size(size_t a, size_t b)
 	return (a < b) ? b : a;
 }
 
+static inline
+size_t round_up_chunk(size_t size)
+{
+	return (size + CHUNK_ALIGN - 1) & ~(size_t)(CHUNK_ALIGN - 1);
+}
+
+/* Returns size of next chunk that has to fit at least needed
+ * bytes. With geometric growth every new chunk is as big as whole
+ * heap so far, so heap doubles and count of chunks stays
+ * logarithmic until we hit max_chunk_size. */
+static
+size_t next_chunk_size(struct mini_state *st, size_t needed)
+{
+	size_t size;
+	if (!st->max_chunk_size)
+		return max_size(CHUNK_SIZE, needed);
+	size = min_size(max_size(st->chunks_size, CHUNK_ALIGN), st->max_chunk_size);
+	return round_up_chunk(max_size(size, needed));
+}
+
 static
 void insert_span(struct mini_state *st, void *at, size_t size)
 {
@@ -92,11 +147,14 @@ void insert_span(struct mini_state *st, void *at, size_t size)
 
 struct mini_state *mini_init(mini_mallocer mallocer, mini_freer freer)
 {
-	struct initial_stuff {
-		struct mini_state state;
-		struct free_span first_span;
-	};
-	struct initial_stuff *first_chunk = mallocer(CHUNK_SIZE);
+	return mini_init_geometric(mallocer, freer, 0);
+}
+
+struct mini_state *mini_init_geometric(mini_mallocer mallocer, mini_freer freer,
+				       size_t max_chunk_size)
+{
+	size_t chunk_size = max_chunk_size ? CHUNK_ALIGN : CHUNK_SIZE;
+	struct initial_stuff *first_chunk = mallocer(chunk_size);
 	char *first_chunk_end;
 	if (!first_chunk)
 		return 0;
@@ -104,27 +162,73 @@ struct mini_state *mini_init(mini_mallocer mallocer, mini_freer freer)
 	first_chunk->state.freer = freer;
 	RB_INIT(&first_chunk->state.head);
 	first_chunk->state.next_chunk = 0;
-	first_chunk_end = (char *)first_chunk + CHUNK_SIZE - sizeof(size_t);
+	first_chunk->state.first_chunk_size = chunk_size;
+	first_chunk->state.chunks_size = chunk_size;
+	first_chunk->state.max_chunk_size = max_chunk_size ? round_up_chunk(max_chunk_size) : 0;
+	first_chunk->state.purge_advice = MADV_DONTNEED;
+	first_chunk_end = (char *)first_chunk + chunk_size - sizeof(size_t);
+	*(size_t *)first_chunk_end = 0;
 	insert_span(&first_chunk->state, &first_chunk->first_span,
 		    first_chunk_end - (char *)&first_chunk->first_span);
 	return &first_chunk->state;
 }
 
+void mini_rebind(struct mini_state *st, mini_mallocer mallocer, mini_freer freer)
+{
+	st->mallocer = mallocer;
+	st->freer = freer;
+}
+
+void mini_set_purge_advice(struct mini_state *st, int advice)
+{
+	st->purge_advice = advice;
+}
+
 void mini_deinit(struct mini_state *st)
 {
-	void **next = st->next_chunk;
+	struct mini_chunk *next = st->next_chunk;
 	mini_freer freer = st->freer;
-	void **current = (void **)st;
+	void *current = st;
 	do {
 		freer(current);
 		current = next;
 		if (!current)
 			return;
-		next = (void **)*current;
+		next = next->next;
 	} while (1);
 }
 
+static
+void reset_chunk(struct mini_state *st, struct free_span *first_span,
+		 char *chunk_end, int purge)
+{
+	size_t *sentinel = (size_t *)(chunk_end - sizeof(size_t));
+	if (purge) {
+		uintptr_t page_size = (uintptr_t)sysconf(_SC_PAGESIZE);
+		uintptr_t start = ((uintptr_t)(first_span + 1) + page_size - 1) & ~(page_size - 1);
+		uintptr_t end = (uintptr_t)sentinel & ~(page_size - 1);
+		if (start < end)
+			madvise((void *)start, end - start, st->purge_advice);
+	}
+	*sentinel = 0;
+	insert_span(st, first_span, (char *)sentinel - (char *)first_span);
+}
+
+void mini_reset(struct mini_state *st, int purge)
+{
+	struct initial_stuff *first = (struct initial_stuff *)st;
+	struct mini_chunk *chunk;
+
+	RB_INIT(&st->head);
+	reset_chunk(st, &first->first_span, (char *)st + st->first_chunk_size, purge);
+	for (chunk = st->next_chunk; chunk; chunk = chunk->next) {
+		struct next_stuff *next = (struct next_stuff *)chunk;
+		reset_chunk(st, &next->first_span, (char *)chunk + chunk->size, purge);
+	}
+}
+
 static void *do_malloc_with_fit(struct mini_state *st, size_t sz, struct free_span *fit);
+static void do_mini_free(struct mini_state *st, void *_ptr);
 
 static inline
 size_t compute_allocation_sz(size_t size)
@@ -134,20 +238,19 @@ size_t compute_allocation_sz(size_t size)
 
 static void *mini_malloc_new_chunk(struct mini_state *st, size_t size)
 {
-	struct next_stuff {
-		void **next_chunk;
-		struct free_span first_span;
-	};
 	struct next_stuff *next_chunk;
 	size_t chunk_overhead = sizeof(size_t)
 		+ offsetof(struct next_stuff, first_span);
-	size_t alloc_size = max_size(CHUNK_SIZE, compute_allocation_sz(size) + chunk_overhead);
+	size_t alloc_size = next_chunk_size(st, compute_allocation_sz(size) + chunk_overhead);
 
 	next_chunk = st->mallocer(alloc_size);
 	if (!next_chunk)
 		return 0;
-	next_chunk->next_chunk = st->next_chunk;
-	st->next_chunk = (void **)next_chunk;
+	next_chunk->chunk.next = st->next_chunk;
+	next_chunk->chunk.size = alloc_size;
+	st->next_chunk = &next_chunk->chunk;
+	st->chunks_size += alloc_size;
+	*(size_t *)((char *)next_chunk + alloc_size - sizeof(size_t)) = 0;
 	insert_span(st, &next_chunk->first_span, alloc_size - chunk_overhead);
 	return do_malloc_with_fit(st, compute_allocation_sz(size), &next_chunk->first_span);
 }
@@ -193,8 +296,6 @@ void *do_malloc_with_fit(struct mini_state *st, size_t sz, struct free_span *fit
 	return (void *)(hdr+1);
 }
 
-static void do_mini_free(struct mini_state *st, void *_ptr);
-
 void mini_free(struct mini_state *st, void *_ptr)
 {
 	if (!_ptr) {
@@ -244,20 +345,219 @@ void *mini_realloc(struct mini_state *st, void *p, size_t new_size)
 	return new_p;
 }
 
+size_t mini_purge(struct mini_state *st, size_t budget)
+{
+	uintptr_t page_size = (uintptr_t)sysconf(_SC_PAGESIZE);
+	struct free_span *span;
+	size_t released = 0;
+
+	RB_FOREACH(span, mini_rb, &st->head) {
+		size_t size = span->size & SPAN_SIZE_VALUE_MASK;
+		uintptr_t start, end;
+		if (span->size & SPAN_SIZE_PURGED_MASK)
+			continue;
+		/* keep span header and footer */
+		start = ((uintptr_t)(span + 1) + page_size - 1) & ~(page_size - 1);
+		end = ((uintptr_t)span + size - sizeof(size_t)) & ~(page_size - 1);
+		if (start >= end)
+			continue;
+		if (madvise((void *)start, end - start, st->purge_advice))
+			break;
+		span->size |= SPAN_SIZE_PURGED_MASK;
+		released += end - start;
+		if (released >= budget)
+			break;
+	}
+	return released;
+}
+
+struct compact_candidate {
+	struct mini_chunk *chunk;
+	size_t live;
+};
+
+static
+size_t *chunk_spans_start(struct mini_chunk *chunk)
+{
+	return (size_t *)&((struct next_stuff *)chunk)->first_span;
+}
+
+static
+size_t *chunk_spans_end(struct mini_chunk *chunk)
+{
+	return (size_t *)((char *)chunk + chunk->size - sizeof(size_t));
+}
+
+static
+size_t chunk_live_bytes(struct mini_chunk *chunk)
+{
+	size_t *p = chunk_spans_start(chunk);
+	size_t *end = chunk_spans_end(chunk);
+	size_t live = 0;
+	while (p < end) {
+		size_t size = *p & SPAN_SIZE_VALUE_MASK;
+		if (!(*p & SPAN_SIZE_FREE_MASK))
+			live += size;
+		p = (size_t *)((char *)p + size);
+	}
+	return live;
+}
+
+/* orders by live ratio. Cross multiplication is fine since chunks
+ * are way smaller than 2^32 */
+static
+int compact_candidate_cmp(const void *_a, const void *_b)
+{
+	const struct compact_candidate *a = _a;
+	const struct compact_candidate *b = _b;
+	size_t x = a->live * (b->chunk->size >> 12);
+	size_t y = b->live * (a->chunk->size >> 12);
+	return (x > y) - (x < y);
+}
+
+/* makes chunk's free space invisible to malloc, so that nothing is
+ * moved into chunks being evacuated */
+static
+void hide_chunk_free_spans(struct mini_state *st, struct mini_chunk *chunk)
+{
+	size_t *end = chunk_spans_end(chunk);
+	size_t *p;
+	for (p = chunk_spans_start(chunk); p < end; p = (size_t *)((char *)p + (*p & SPAN_SIZE_VALUE_MASK))) {
+		if (*p & SPAN_SIZE_FREE_MASK)
+			mini_rb_RB_REMOVE(&st->head, (struct free_span *)p);
+	}
+}
+
+/* Moves live spans out of chunk while they fit into free spans of
+ * other chunks and budget allows. Returns first span that wasn't
+ * moved or end of chunk if all were. */
+static
+size_t *evacuate_chunk(struct mini_state *st, struct mini_chunk *chunk, size_t *budget,
+		       mini_relocate_cb cb, void *cb_data)
+{
+	size_t *end = chunk_spans_end(chunk);
+	size_t *p;
+
+	for (p = chunk_spans_start(chunk); p < end; p = (size_t *)((char *)p + (*p & SPAN_SIZE_VALUE_MASK))) {
+		size_t sz = *p & SPAN_SIZE_VALUE_MASK;
+		struct free_span perfect_fit = {.size = sz};
+		struct free_span *fit;
+		void *new_p;
+
+		if (*p & SPAN_SIZE_FREE_MASK)
+			continue;
+		fit = mini_rb_RB_NFIND(&st->head, &perfect_fit);
+		if (!fit || sz > *budget)
+			break;
+		*budget -= sz;
+		new_p = do_malloc_with_fit(st, sz, fit);
+		memcpy(new_p, p + 1, sz - sizeof(size_t));
+		cb(p + 1, new_p, cb_data);
+	}
+	return p;
+}
+
+/* Puts partially evacuated chunk back. Every allocated span before
+ * stop is moved and is freed normally, once free spans are back in
+ * tree */
+static
+void restore_chunk(struct mini_state *st, struct mini_chunk *chunk, size_t *stop)
+{
+	size_t *start = chunk_spans_start(chunk);
+	size_t *end = chunk_spans_end(chunk);
+	size_t *p;
+
+	for (p = start; p < end; p = (size_t *)((char *)p + (*p & SPAN_SIZE_VALUE_MASK))) {
+		if (*p & SPAN_SIZE_FREE_MASK)
+			mini_rb_RB_INSERT(&st->head, (struct free_span *)p);
+	}
+	for (p = start; p < stop; ) {
+		size_t *next = (size_t *)((char *)p + (*p & SPAN_SIZE_VALUE_MASK));
+		if (*p & SPAN_SIZE_FREE_MASK) {
+			p = next;
+			continue;
+		}
+		/* next span will be merged with p, so skip it too */
+		if (*next & SPAN_SIZE_FREE_MASK)
+			next = (size_t *)((char *)next + (*next & SPAN_SIZE_VALUE_MASK));
+		do_mini_free(st, p + 1);
+		p = next;
+	}
+}
+
+size_t mini_compact(struct mini_state *st, size_t budget,
+		    mini_relocate_cb cb, void *cb_data)
+{
+	struct compact_candidate *candidates;
+	struct mini_chunk *chunk;
+	size_t count = 0;
+	size_t selected;
+	size_t released = 0;
+	size_t planned = 0;
+	size_t i;
+
+	for (chunk = st->next_chunk; chunk; chunk = chunk->next)
+		count++;
+	if (!count || !budget)
+		return 0;
+
+	candidates = malloc(sizeof(*candidates) * count);
+	if (!candidates)
+		return 0;
+	for (i = 0, chunk = st->next_chunk; chunk; chunk = chunk->next, i++) {
+		candidates[i].chunk = chunk;
+		candidates[i].live = chunk_live_bytes(chunk);
+	}
+	qsort(candidates, count, sizeof(*candidates), compact_candidate_cmp);
+
+	/* pick chunks that budget covers plus one that will be
+	 * evacuated partially. Their free space is hidden up front,
+	 * so that nothing is moved twice. Chunks that are at least
+	 * half live are not worth moving: free space they'd release
+	 * is smaller than what they'd eat elsewhere */
+	for (selected = 0; selected < count && planned < budget; selected++) {
+		if (candidates[selected].live >= candidates[selected].chunk->size / 2)
+			break;
+		planned += candidates[selected].live;
+		hide_chunk_free_spans(st, candidates[selected].chunk);
+	}
+
+	for (i = 0; i < selected; i++) {
+		size_t *stop;
+		chunk = candidates[i].chunk;
+		stop = evacuate_chunk(st, chunk, &budget, cb, cb_data);
+		if (stop < chunk_spans_end(chunk)) {
+			restore_chunk(st, chunk, stop);
+			continue;
+		}
+		struct mini_chunk **pprev;
+		for (pprev = &st->next_chunk; *pprev != chunk; pprev = &(*pprev)->next)
+			;
+		*pprev = chunk->next;
+		st->chunks_size -= chunk->size;
+		released += chunk->size;
+		st->freer(chunk);
+	}
+
+	free(candidates);
+	return released;
+}
+
 void mini_get_stats(struct mini_state *st, struct mini_stats *stats, mini_span_cb cb, void *cb_data)
 {
 	unsigned chunks_count = 1;
-	void **chunk = st->next_chunk;
+	struct mini_chunk *chunk = st->next_chunk;
 	struct free_span *span;
 
 	while (chunk) {
 		chunks_count++;
-		chunk = (void **)*chunk;
+		chunk = chunk->next;
 	}
 
 	stats->free_spans_count = 0;
 	stats->free_space = 0;
 	stats->os_chunks_count = chunks_count;
+	stats->os_chunks_size = st->chunks_size;
 
 	RB_FOREACH(span, mini_rb, &st->head) {
 		size_t size = span->size & SPAN_SIZE_VALUE_MASK;
@@ -8,13 +8,29 @@ typedef void *(*mini_mallocer)(size_t size);
 typedef void (*mini_freer)(void *);
 
 extern struct mini_state *mini_init(mini_mallocer mallocer, mini_freer freer);
+/* same as mini_init but instead of fixed 4 megs chunks, every new
+ * chunk is as big as heap so far (i.e. heap doubles), rounded up to
+ * 2 megs and capped at max_chunk_size. 0 max_chunk_size means fixed
+ * chunks. */
+extern struct mini_state *mini_init_geometric(mini_mallocer mallocer, mini_freer freer,
+					      size_t max_chunk_size);
 extern void mini_deinit(struct mini_state *st);
+/* replaces heap's chunk callbacks. Needed when heap outlives process
+ * that created it (see mini_persist_open) since callbacks addresses
+ * are not stable across executions */
+extern void mini_rebind(struct mini_state *st, mini_mallocer mallocer, mini_freer freer);
+/* frees all allocations at once keeping all chunks. I.e. free index
+ * is rebuilt as single span per chunk. If purge is non-zero, pages of
+ * chunks are also given back to OS (see mini_set_purge_advice).
+ * O(chunks). */
+extern void mini_reset(struct mini_state *st, int purge);
 extern void *mini_malloc(struct mini_state *, size_t size);
 extern void mini_free(struct mini_state *, void *);
 extern void *mini_realloc(struct mini_state *, void *, size_t);
 
 struct mini_stats {
 	unsigned os_chunks_count;
+	size_t os_chunks_size;
 	unsigned free_spans_count;
 	size_t free_space;
 };
@@ -37,4 +53,55 @@ struct mini_spans {
 
 extern int mini_fill_mini_spans(struct mini_state *st, struct mini_spans *spans);
 
+/* gives pages of free spans back to OS (see mini_set_purge_advice),
+ * skipping spans that were already purged, until at least budget
+ * bytes are released. Returns bytes released */
+extern size_t mini_purge(struct mini_state *st, size_t budget);
+/* madvise advice pages are given back with, MADV_DONTNEED by
+ * default. Chunks mapped MAP_SHARED from file keep their pages in
+ * file (and page cache) after MADV_DONTNEED, so such heaps need
+ * MADV_REMOVE, which punches hole instead */
+extern void mini_set_purge_advice(struct mini_state *st, int advice);
+
+typedef void (*mini_relocate_cb)(void *old_p, void *new_p, void *cb_data);
+
+/* Evacuates chunks with lowest live ratio first (only chunks less
+ * than half live are considered), moving their
+ * allocations into free spans of other chunks and calling cb for
+ * every moved allocation. Emptied chunks are given back via
+ * freer. At most budget bytes are moved per call, so pauses are
+ * bounded and partially evacuated chunk is continued by next
+ * call. First chunk is never released. Returns bytes released. */
+extern size_t mini_compact(struct mini_state *st, size_t budget,
+			   mini_relocate_cb cb, void *cb_data);
+
+/* Persistent heaps (mini-persist.c).
+ *
+ * Heap lives in a file that is mapped MAP_SHARED at fixed base
+ * address. Because mapping is always at same address, all pointers
+ * inside heap (including free spans tree) stay valid, so reopening
+ * existing file reattaches heap as is, without any rebuilding. size
+ * is only used when file is created. Chunks are carved from file
+ * sequentially and are never given back to file.
+ *
+ * Only one persistent heap per process is supported, since
+ * mini_mallocer has no context argument.
+ *
+ * Returns 0 (with errno set) if file cannot be mapped at base or
+ * contains something else than heap (EINVAL). Heap that was not
+ * closed by mini_persist_close (process died, maybe in the middle of
+ * malloc or free) is refused with EUCLEAN; there is no way to repair
+ * it, file has to be removed. *reattached is set to 1 if existing
+ * heap was reattached. */
+#define MINI_PERSIST_DEFAULT_BASE ((void *)0x200000000000ULL)
+
+extern struct mini_state *mini_persist_open(const char *path, void *base,
+					    size_t size, int *reattached);
+extern void mini_persist_close(struct mini_state *st);
+/* slot for application's own root pointer (i.e. it's index of
+ * objects) that is persisted along with heap */
+extern void **mini_persist_root(void);
+/* bytes of file consumed by chunks so far */
+extern size_t mini_persist_used(void);
+
 #endif
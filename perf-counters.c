@@ -0,0 +1,281 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "perf-counters.h"
+
+#define MAX_PERF_THREADS 1024
+
+struct phase_counts {
+	uint64_t ops;
+	uint64_t enabled;
+	uint64_t running;
+	uint64_t values[PERF_COUNTERS];
+};
+
+/* layout of PERF_FORMAT_GROUP read with both times */
+struct group_read {
+	uint64_t nr;
+	uint64_t enabled;
+	uint64_t running;
+	uint64_t values[PERF_COUNTERS];
+};
+
+struct perf_thread {
+	int leader;
+	/* index of counter in group read, -1 if n/a */
+	int slot[PERF_COUNTERS];
+	int phase;
+	unsigned long ops;
+	struct group_read last;
+	struct phase_counts phases[LAT_PHASES];
+};
+
+bool perf_enabled;
+
+static __thread struct perf_thread *perf_thread;
+
+static struct perf_thread *all_threads[MAX_PERF_THREADS];
+static int all_threads_count;
+static pthread_mutex_t all_threads_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* counters that failed to open in some thread */
+static int unavailable_mask;
+/* decided once by probe_user_only, for all counters of all threads */
+static bool user_only;
+static pthread_once_t probe_once = PTHREAD_ONCE_INIT;
+
+static const struct {
+	const char *name;
+	uint32_t type;
+	uint64_t config;
+} events[PERF_COUNTERS] = {
+	[PERF_CYCLES] = {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+	[PERF_INSTRUCTIONS] = {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+	[PERF_CACHE_MISSES] = {"cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+	[PERF_DTLB_MISSES] = {"dTLB-misses", PERF_TYPE_HW_CACHE,
+			      PERF_COUNT_HW_CACHE_DTLB
+			      | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+			      | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+	[PERF_PAGE_FAULTS] = {"page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS}
+};
+
+static const char *phase_names[LAT_PHASES] = {"fill", "bump", "random free", "replay"};
+
+static
+int open_event(int counter, int group_fd, bool exclude_kernel)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[counter].type;
+	attr.config = events[counter].config;
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED
+		| PERF_FORMAT_TOTAL_TIME_RUNNING;
+	attr.exclude_hv = 1;
+	attr.exclude_kernel = exclude_kernel;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+/* perf_event_paranoid >= 2 only allows user space counting. Then
+ * all counters count user space only, to stay comparable with each
+ * other */
+static
+void probe_user_only(void)
+{
+	for (int k = 0; k < PERF_COUNTERS; k++) {
+		int fd = open_event(k, -1, false);
+		if (fd >= 0) {
+			close(fd);
+			return;
+		}
+		if (errno == EACCES || errno == EPERM) {
+			user_only = true;
+			return;
+		}
+	}
+}
+
+void perf_register_thread(void)
+{
+	struct perf_thread *t = calloc(1, sizeof(*t));
+	int count = 0;
+
+	if (!t) {
+		perror("calloc");
+		abort();
+	}
+	pthread_once(&probe_once, probe_user_only);
+	t->leader = -1;
+	t->phase = PERF_NO_PHASE;
+	for (int k = 0; k < PERF_COUNTERS; k++) {
+		int fd = open_event(k, t->leader, user_only);
+		t->slot[k] = -1;
+		if (fd < 0) {
+			if (!(__atomic_fetch_or(&unavailable_mask, 1 << k, __ATOMIC_RELAXED) & (1 << k))) {
+				fprintf(stderr, "perf: %s n/a: %s\n", events[k].name, strerror(errno));
+			}
+			continue;
+		}
+		if (t->leader < 0) {
+			t->leader = fd;
+		}
+		t->slot[k] = count++;
+	}
+	if (t->leader < 0) {
+		fprintf(stderr, "perf: no counters available, not counting\n");
+		perf_enabled = false;
+		free(t);
+		return;
+	}
+
+	pthread_mutex_lock(&all_threads_lock);
+	if (all_threads_count >= MAX_PERF_THREADS) {
+		fprintf(stderr, "too many perf counter threads\n");
+		abort();
+	}
+	all_threads[all_threads_count++] = t;
+	pthread_mutex_unlock(&all_threads_lock);
+	perf_thread = t;
+}
+
+static
+void read_group(struct perf_thread *t, struct group_read *r)
+{
+	if (read(t->leader, r, sizeof(*r)) < (ssize_t)(3 * sizeof(uint64_t))) {
+		perror("read perf counters");
+		abort();
+	}
+}
+
+int perf_set_phase(int phase, unsigned long ops)
+{
+	struct perf_thread *t = perf_thread;
+	struct group_read now;
+	int old_phase;
+
+	if (!t) {
+		return PERF_NO_PHASE;
+	}
+	read_group(t, &now);
+	if (t->phase != PERF_NO_PHASE) {
+		struct phase_counts *p = &t->phases[t->phase];
+		p->ops += ops - t->ops;
+		p->enabled += now.enabled - t->last.enabled;
+		p->running += now.running - t->last.running;
+		for (int k = 0; k < PERF_COUNTERS; k++) {
+			if (t->slot[k] >= 0) {
+				p->values[k] += now.values[t->slot[k]] - t->last.values[t->slot[k]];
+			}
+		}
+	}
+	old_phase = t->phase;
+	t->last = now;
+	t->ops = ops;
+	t->phase = phase;
+	return old_phase;
+}
+
+void perf_reset(unsigned long ops)
+{
+	if (perf_thread) {
+		perf_set_phase(perf_thread->phase, ops);
+	}
+	pthread_mutex_lock(&all_threads_lock);
+	for (int k = 0; k < all_threads_count; k++) {
+		memset(all_threads[k]->phases, 0, sizeof(all_threads[k]->phases));
+	}
+	pthread_mutex_unlock(&all_threads_lock);
+}
+
+struct merged_counts {
+	uint64_t ops;
+	double values[PERF_COUNTERS];
+};
+
+/* sums threads, scaling every thread's phase by it's multiplexing */
+static
+void merge_phase(int phase, struct merged_counts *m)
+{
+	pthread_mutex_lock(&all_threads_lock);
+	for (int k = 0; k < all_threads_count; k++) {
+		const struct phase_counts *p = &all_threads[k]->phases[phase];
+		double scale = p->running && p->running < p->enabled
+			? (double)p->enabled / p->running : 1;
+		m->ops += p->ops;
+		for (int c = 0; c < PERF_COUNTERS; c++) {
+			m->values[c] += p->values[c] * scale;
+		}
+	}
+	pthread_mutex_unlock(&all_threads_lock);
+}
+
+static
+bool available(int counter)
+{
+	return !(__atomic_load_n(&unavailable_mask, __ATOMIC_RELAXED) & (1 << counter));
+}
+
+static
+void print_counts(FILE *f, const char *name, const struct merged_counts *m)
+{
+	fprintf(f, "  %-12s %12llu", name, (unsigned long long)m->ops);
+	for (int c = 0; c < PERF_COUNTERS; c++) {
+		if (available(c)) {
+			fprintf(f, " %13.4g", m->values[c] / m->ops);
+		} else {
+			fprintf(f, " %13s", "n/a");
+		}
+	}
+	if (available(PERF_CYCLES) && available(PERF_INSTRUCTIONS) && m->values[PERF_CYCLES]) {
+		fprintf(f, " %6.2f\n", m->values[PERF_INSTRUCTIONS] / m->values[PERF_CYCLES]);
+	} else {
+		fprintf(f, " %6s\n", "n/a");
+	}
+}
+
+void perf_print(FILE *f)
+{
+	struct merged_counts total = {0};
+
+	fprintf(f, "perf counters per op%s:\n  %-12s %12s", user_only ? " (user space only)" : "",
+		"phase", "ops");
+	for (int c = 0; c < PERF_COUNTERS; c++) {
+		fprintf(f, " %13s", events[c].name);
+	}
+	fprintf(f, " %6s\n", "IPC");
+	for (int phase = 0; phase < LAT_PHASES; phase++) {
+		struct merged_counts m = {0};
+		merge_phase(phase, &m);
+		if (!m.ops) {
+			continue;
+		}
+		print_counts(f, phase_names[phase], &m);
+		total.ops += m.ops;
+		for (int c = 0; c < PERF_COUNTERS; c++) {
+			total.values[c] += m.values[c];
+		}
+	}
+	if (total.ops) {
+		print_counts(f, "all", &total);
+	}
+}
+
+bool perf_summary(bool has[PERF_COUNTERS], double per_op[PERF_COUNTERS])
+{
+	struct merged_counts total = {0};
+	for (int phase = 0; phase < LAT_PHASES; phase++) {
+		merge_phase(phase, &total);
+	}
+	for (int c = 0; c < PERF_COUNTERS; c++) {
+		has[c] = total.ops && available(c);
+		per_op[c] = has[c] ? total.values[c] / total.ops : 0;
+	}
+	return total.ops;
+}
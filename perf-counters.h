@@ -0,0 +1,52 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "latency.h"
+
+/*
+ * Hardware and software event counts per workload phase (-E), via
+ * perf_event_open. Every workload thread opens one counter group for
+ * itself, and on every phase switch reads it (single read(2) of
+ * whole group) and adds deltas, together with ops done meanwhile,
+ * to phase it leaves. Phases are the ones of latency histograms.
+ *
+ * Counters that can't be opened (no PMU in VMs, perf_event_paranoid)
+ * are reported as n/a. If none of them can, counting is turned off
+ * with a warning. If kernel counting isn't permitted (found out once,
+ * before any group is opened), all counters count user space only.
+ * Counts are scaled by time enabled/running, when kernel had to
+ * multiplex group.
+ */
+
+enum perf_counter {
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_CACHE_MISSES,
+	PERF_DTLB_MISSES,
+	PERF_PAGE_FAULTS,
+	PERF_COUNTERS
+};
+
+/* outside of any phase, i.e. not counted */
+#define PERF_NO_PHASE LAT_PHASES
+
+extern bool perf_enabled;
+
+/* opens counter group for calling thread. Threads that don't call
+ * it aren't counted. Turns perf_enabled off if nothing could be
+ * opened */
+extern void perf_register_thread(void);
+/* ops is calling thread's count of allocs and frees so far. Returns
+ * phase it was in */
+extern int perf_set_phase(int phase, unsigned long ops);
+/* forgets counts of all threads so far (e.g. warmup) */
+extern void perf_reset(unsigned long ops);
+/* prints per op counts of every phase and of all of them */
+extern void perf_print(FILE *f);
+/* per op counts over all phases. has[k] is false for counters that
+ * are n/a. false if nothing was counted */
+extern bool perf_summary(bool has[PERF_COUNTERS], double per_op[PERF_COUNTERS]);
+
+#endif
@@ -0,0 +1,135 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "prefault.h"
+
+/* since linux 5.14 */
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+enum prefault_policy prefault_policy = PREFAULT_TOUCH;
+
+static const char *const policy_names[] = {
+	[PREFAULT_TOUCH] = "touch",
+	[PREFAULT_POPULATE] = "populate",
+	[PREFAULT_NONE] = "none"
+};
+
+/* regions may come from several threads (dlms) */
+static unsigned long regions;
+static size_t region_bytes;
+static long region_faults;
+static int populate_unsupported;
+
+int prefault_set_policy(const char *name)
+{
+	for (int k = 0; k < (int)(sizeof(policy_names) / sizeof(policy_names[0])); k++) {
+		if (strcmp(name, policy_names[k]) == 0) {
+			prefault_policy = k;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+const char *prefault_policy_name(void)
+{
+	return policy_names[prefault_policy];
+}
+
+void *touch_pages(void *_p, size_t size)
+{
+	char *p = _p;
+	char *pend = p + size;
+	do {
+		*p = 0;
+		p += ((~(uintptr_t)p) & 4095) + 1;
+	} while (p < pend);
+	return _p;
+}
+
+static
+long thread_minflt(void)
+{
+	struct rusage ru;
+	getrusage(RUSAGE_THREAD, &ru);
+	return ru.ru_minflt;
+}
+
+static
+void account_region(size_t size, long faults)
+{
+	__atomic_add_fetch(&regions, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&region_bytes, size, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&region_faults, faults, __ATOMIC_RELAXED);
+}
+
+void *prefault_region(void *p, size_t size)
+{
+	uintptr_t page = getpagesize();
+	uintptr_t start = (uintptr_t)p & ~(page - 1);
+	uintptr_t end = ((uintptr_t)p + size + page - 1) & ~(page - 1);
+	long faults;
+
+	if (prefault_policy != PREFAULT_POPULATE || !p || !size) {
+		return p;
+	}
+	faults = thread_minflt();
+	if (__atomic_load_n(&populate_unsupported, __ATOMIC_RELAXED)
+	    || madvise((void *)start, end - start, MADV_POPULATE_WRITE)) {
+		if (!__atomic_exchange_n(&populate_unsupported, 1, __ATOMIC_RELAXED)) {
+			perror("madvise(MADV_POPULATE_WRITE), touching pages instead");
+		}
+		touch_pages(p, size);
+	}
+	account_region(size, thread_minflt() - faults);
+	return p;
+}
+
+void *prefault_mmap(void *addr, size_t size, int flags)
+{
+	void *p;
+	long faults;
+
+	flags |= MAP_PRIVATE | MAP_ANONYMOUS;
+	if (prefault_policy != PREFAULT_POPULATE) {
+		return mmap(addr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+	}
+	faults = thread_minflt();
+	p = mmap(addr, size, PROT_READ | PROT_WRITE, flags | MAP_POPULATE, -1, 0);
+	if (p != MAP_FAILED) {
+		account_region(size, thread_minflt() - faults);
+	}
+	return p;
+}
+
+void *prefault_sbrk(intptr_t increment)
+{
+	void *p = sbrk(increment);
+	if (increment > 0 && p != (void *)-1) {
+		prefault_region(p, increment);
+	}
+	return p;
+}
+
+void *prefault_dl_mmap(size_t size)
+{
+	return prefault_mmap(NULL, size, 0);
+}
+
+void prefault_print(FILE *f, long minflt)
+{
+	long faults = __atomic_load_n(&region_faults, __ATOMIC_RELAXED);
+	fprintf(f, "prefault %s: %lu regions, %zu bytes, %ld faults prefaulting, %ld other faults\n",
+		prefault_policy_name(),
+		__atomic_load_n(&regions, __ATOMIC_RELAXED),
+		__atomic_load_n(&region_bytes, __ATOMIC_RELAXED),
+		faults, minflt - faults);
+}
@@ -0,0 +1,58 @@
+#ifndef PREFAULT_H
+#define PREFAULT_H
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Who faults in pages of heap (-F):
+ *
+ *   touch     every allocation writes byte per page of it, so fault
+ *             cost lands in alloc timing (default, as always)
+ *   populate  allocators prefault every region they get from OS
+ *             when they get it: MAP_POPULATE for mmap-ed regions
+ *             (buddy superblocks, dlmalloc segments), otherwise
+ *             MADV_POPULATE_WRITE (sbrk growth, mini chunks)
+ *   none      pages fault on first use by allocator itself
+ *
+ * jemalloc adaptor (which is plain malloc) has no region hook, so
+ * populate does nothing for it.
+ *
+ * This header is also force-included into dl-malloc.c, which calls
+ * prefault_sbrk and prefault_dl_mmap as it's MORECORE and MMAP.
+ */
+enum prefault_policy {
+	PREFAULT_TOUCH,
+	PREFAULT_POPULATE,
+	PREFAULT_NONE
+};
+
+extern enum prefault_policy prefault_policy;
+
+extern void *touch_pages(void *p, size_t size);
+
+extern int prefault_set_policy(const char *name);
+extern const char *prefault_policy_name(void);
+
+/* for allocators without region hooks, on every allocation */
+static inline
+void *prefault_alloc(void *p, size_t size)
+{
+	if (prefault_policy == PREFAULT_TOUCH && p) {
+		touch_pages(p, size);
+	}
+	return p;
+}
+
+/* new region p of size bytes allocator just got. Returns p */
+extern void *prefault_region(void *p, size_t size);
+/* anonymous read-write mmap of region, populated if policy says
+ * so. flags are added to MAP_PRIVATE | MAP_ANONYMOUS */
+extern void *prefault_mmap(void *addr, size_t size, int flags);
+extern void *prefault_sbrk(intptr_t increment);
+extern void *prefault_dl_mmap(size_t size);
+
+/* minflt is total faults of process so far */
+extern void prefault_print(FILE *f, long minflt);
+
+#endif
@@ -0,0 +1,45 @@
+#include "rng.h"
+
+static
+uint64_t splitmix64(uint64_t *x)
+{
+	uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/* advances r by 2^128 numbers */
+static
+void rng_jump(struct rng *r)
+{
+	static const uint64_t jump[] = {
+		0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+		0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL
+	};
+	uint64_t s[4] = {0};
+	for (int i = 0; i < 4; i++) {
+		for (int b = 0; b < 64; b++) {
+			if (jump[i] & (1ULL << b)) {
+				for (int k = 0; k < 4; k++) {
+					s[k] ^= r->s[k];
+				}
+			}
+			rng_next(r);
+		}
+	}
+	for (int k = 0; k < 4; k++) {
+		r->s[k] = s[k];
+	}
+}
+
+void rng_seed(struct rng *r, uint64_t seed, unsigned stream)
+{
+	/* splitmix64 never gives all zero state */
+	for (int k = 0; k < 4; k++) {
+		r->s[k] = splitmix64(&seed);
+	}
+	while (stream--) {
+		rng_jump(r);
+	}
+}
@@ -0,0 +1,72 @@
+#ifndef RNG_H
+#define RNG_H
+#include <stdint.h>
+#include <math.h>
+
+/*
+ * Workload random numbers. xoshiro256** is few instructions inline,
+ * unlike random() which is libc call taking a lock. Every stream of
+ * same seed starts 2^128 numbers apart from previous one, so threads
+ * get independent and reproducible sequences.
+ */
+struct rng {
+	uint64_t s[4];
+};
+
+extern void rng_seed(struct rng *r, uint64_t seed, unsigned stream);
+
+static inline
+uint64_t rng_rotl(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+static inline
+uint64_t rng_next(struct rng *r)
+{
+	uint64_t *s = r->s;
+	uint64_t rv = rng_rotl(s[1] * 5, 7) * 9;
+	uint64_t t = s[1] << 17;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rng_rotl(s[3], 45);
+	return rv;
+}
+
+/* same range as random() */
+static inline
+uint32_t rng_u31(struct rng *r)
+{
+	return rng_next(r) >> 33;
+}
+
+/* uniform in [0, n) */
+static inline
+uint32_t rng_below(struct rng *r, uint32_t n)
+{
+	return ((rng_next(r) >> 32) * n) >> 32;
+}
+
+/* uniform in (0, 1] */
+static inline
+double rng_unit(struct rng *r)
+{
+	return ((rng_next(r) >> 11) + 1) * 0x1p-53;
+}
+
+/*
+ * Number of failed trials before first success, when every trial
+ * succeeds with probability p. log_q is log1p(-p), which callers
+ * compute once. Lets workload visit only items that are picked with
+ * probability p, instead of drawing random number for every item.
+ */
+static inline
+unsigned long rng_geometric(struct rng *r, double log_q)
+{
+	return log(rng_unit(r)) / log_q;
+}
+
+#endif
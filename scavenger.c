@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "common.h"
+#include "scavenger.h"
+
+#define TICK_MS 100
+
+bool scavenger_running;
+pthread_mutex_t scavenger_lock = PTHREAD_MUTEX_INITIALIZER;
+unsigned long scavenger_ops;
+
+static struct scavenger_config config;
+static pthread_t thread;
+static volatile bool stopping;
+static FILE *log_file;
+static size_t total_released;
+
+static
+uint64_t now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static
+void *scavenger_thread(void *dummy)
+{
+	uint64_t start = now_ms();
+	uint64_t last_activity = start;
+	unsigned long last_ops = 0;
+	/* may go negative, if allocator released more than we asked
+	 * for (i.e. whole buddy block). Then it's repaid by next
+	 * ticks, so that rate holds on average */
+	ssize_t credit = 0;
+
+	while (!stopping) {
+		struct timespec ts = {.tv_sec = 0, .tv_nsec = TICK_MS * 1000000};
+		size_t released = 0;
+		size_t footprint;
+		uint64_t now;
+
+		nanosleep(&ts, NULL);
+		now = now_ms();
+
+		pthread_mutex_lock(&scavenger_lock);
+		if (scavenger_ops != last_ops) {
+			last_ops = scavenger_ops;
+			last_activity = now;
+		}
+		if (now - last_activity >= config.idle_ms) {
+			credit += config.rate * TICK_MS / 1000;
+			if (credit > 0 && main_fns->release_free_memory) {
+				released = main_fns->release_free_memory(credit);
+				credit -= released;
+				total_released += released;
+			}
+		} else if (credit > 0) {
+			credit = 0;
+		}
+		footprint = main_fns->get_total_allocated_size();
+		pthread_mutex_unlock(&scavenger_lock);
+
+		if (log_file) {
+			fprintf(log_file, "%.3f %zu %zu %zu\n",
+				(now - start) / 1000.0, rss_allocated(),
+				footprint, released);
+		}
+	}
+	return NULL;
+}
+
+void scavenger_start(const struct scavenger_config *cfg)
+{
+	int error;
+	config = *cfg;
+	if (!main_fns->release_free_memory) {
+		fprintf(stderr, "warning: %s can't release free memory\n", main_fns->name);
+	}
+	if (config.log_path) {
+		log_file = fopen(config.log_path, "w");
+		if (!log_file) {
+			perror("fopen");
+			abort();
+		}
+		setvbuf(log_file, NULL, _IOLBF, 0);
+		fprintf(log_file, "# seconds rss footprint released\n");
+	}
+	__atomic_store_n(&scavenger_running, true, __ATOMIC_RELEASE);
+	error = pthread_create(&thread, NULL, scavenger_thread, NULL);
+	if (error) {
+		errno = error;
+		perror("pthread_create");
+		abort();
+	}
+}
+
+void scavenger_stop(void)
+{
+	if (!scavenger_running) {
+		return;
+	}
+	stopping = true;
+	pthread_join(thread, NULL);
+	__atomic_store_n(&scavenger_running, false, __ATOMIC_RELEASE);
+	if (log_file) {
+		fclose(log_file);
+		log_file = NULL;
+	}
+	printf("scavenger released: %zu\n", total_released);
+}
@@ -0,0 +1,53 @@
+#ifndef SCAVENGER_H
+#define SCAVENGER_H
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+/*
+ * Background thread that gives free memory back to OS via
+ * allocator's release_free_memory at given rate, once workload has
+ * been idle (no allocs or frees) for idle_ms. Optionally logs RSS
+ * and allocator footprint over time.
+ */
+struct scavenger_config {
+	/* bytes per second */
+	size_t rate;
+	unsigned idle_ms;
+	/* may be NULL */
+	const char *log_path;
+};
+
+extern void scavenger_start(const struct scavenger_config *cfg);
+extern void scavenger_stop(void);
+
+/* allocators are not thread-safe in general, so while scavenger is
+ * running every alloc and free has to be done between
+ * scavenger_enter and scavenger_leave. Single global lock would
+ * serialize workload threads, so scavenger can't be combined with
+ * -T. scavenger_leave is passed what scavenger_enter returned, so
+ * that lock is released even if scavenger stopped meanwhile */
+extern bool scavenger_running;
+extern pthread_mutex_t scavenger_lock;
+extern unsigned long scavenger_ops;
+
+static inline
+bool scavenger_enter(void)
+{
+	if (__atomic_load_n(&scavenger_running, __ATOMIC_ACQUIRE)) {
+		pthread_mutex_lock(&scavenger_lock);
+		return true;
+	}
+	return false;
+}
+
+static inline
+void scavenger_leave(bool locked)
+{
+	if (locked) {
+		scavenger_ops++;
+		pthread_mutex_unlock(&scavenger_lock);
+	}
+}
+
+#endif
@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include "scenario.h"
+
+#define MAX_WORDS (MAX_SIZE_DISTS + 4)
+
+static const char *file_path;
+static int line_no;
+
+static __attribute__((noreturn, format(printf, 1, 2)))
+void syntax_error(const char *fmt, ...)
+{
+	va_list ap;
+	fprintf(stderr, "%s:%d: ", file_path, line_no);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+	exit(1);
+}
+
+static
+double parse_double(const char *word, double min)
+{
+	char *end;
+	double rv = strtod(word, &end);
+	if (!*word || *end || !(rv >= min)) {
+		syntax_error("invalid number: %s", word);
+	}
+	return rv;
+}
+
+static
+unsigned long parse_ulong(const char *word, unsigned long min, unsigned long max)
+{
+	char *end;
+	unsigned long rv = strtoul(word, &end, 10);
+	if (!*word || *end || rv < min || rv > max) {
+		syntax_error("invalid number: %s", word);
+	}
+	return rv;
+}
+
+static
+void expect_words(int count, int min, int max)
+{
+	if (count < min || count > max) {
+		syntax_error("wrong number of arguments");
+	}
+}
+
+static
+void parse_sizes(struct scenario_phase *ph, char **words, int count)
+{
+	int k;
+	expect_words(count, 3, MAX_WORDS);
+	if (strcmp(words[1], "uniform") == 0) {
+		expect_words(count, 4, 4);
+		ph->type = PHASE_SIZES_UNIFORM;
+		ph->a = parse_ulong(words[2], 1, 2*1024*1024);
+		ph->b = parse_ulong(words[3], 1, 20*1024*1024);
+		return;
+	}
+	if (strcmp(words[1], "histo") != 0) {
+		syntax_error("unknown size distribution: %s", words[1]);
+	}
+	ph->type = PHASE_SIZES_HISTO;
+	ph->mix_period = 10000;
+	for (k = 2; k < count; k++) {
+		if (strcmp(words[k], "mix") == 0) {
+			expect_words(count, k + 2, k + 2);
+			ph->mix_period = parse_ulong(words[k + 1], 1, 0x7fffffff);
+			break;
+		}
+		if (ph->dists_count == MAX_SIZE_DISTS) {
+			syntax_error("too many histograms");
+		}
+		ph->dists[ph->dists_count++] = size_dist_load(words[k]);
+	}
+	if (!ph->dists_count) {
+		syntax_error("no histograms given");
+	}
+}
+
+static
+void parse_phase(struct scenario_phase *ph, char **words, int count)
+{
+	const char *cmd = words[0];
+	if (strcmp(cmd, "fill") == 0) {
+		expect_words(count, 2, 2);
+		ph->type = PHASE_FILL;
+		ph->value = parse_double(words[1], 1);
+	} else if (strcmp(cmd, "churn") == 0) {
+		expect_words(count, 3, 3);
+		ph->type = PHASE_CHURN;
+		ph->a = parse_ulong(words[1], 1, ~0UL);
+		ph->b = parse_ulong(words[2], 1, 1000);
+	} else if (strcmp(cmd, "grow") == 0 || strcmp(cmd, "shrink") == 0) {
+		expect_words(count, 2, 2);
+		ph->type = cmd[0] == 'g' ? PHASE_GROW : PHASE_SHRINK;
+		ph->value = parse_double(words[1], 1);
+	} else if (strcmp(cmd, "sizes") == 0) {
+		parse_sizes(ph, words, count);
+	} else if (strcmp(cmd, "free") == 0) {
+		expect_words(count, 2, 2);
+		ph->type = PHASE_FREE;
+		ph->value = parse_double(words[1], 0);
+		if (ph->value > 100) {
+			syntax_error("invalid percentage: %s", words[1]);
+		}
+	} else if (strcmp(cmd, "bump") == 0) {
+		expect_words(count, 1, 1);
+		ph->type = PHASE_BUMP;
+	} else if (strcmp(cmd, "replay") == 0) {
+		if (count != 2) {
+			expect_words(count, 4, 4);
+		}
+		ph->type = PHASE_REPLAY;
+		ph->path = strdup(words[1]);
+		ph->a = 0;
+		ph->b = ~0UL;
+		if (count == 4) {
+			ph->a = parse_ulong(words[2], 0, ~0UL);
+			ph->b = parse_ulong(words[3], 1, ~0UL);
+		}
+	} else {
+		syntax_error("unknown phase: %s", cmd);
+	}
+}
+
+struct scenario *scenario_load(const char *path)
+{
+	struct scenario *sc = calloc(1, sizeof(*sc));
+	int capacity = 0;
+	char buf[4096];
+	FILE *f;
+
+	if (!sc) {
+		perror("calloc");
+		abort();
+	}
+	f = fopen(path, "r");
+	if (!f) {
+		perror("fopen");
+		abort();
+	}
+	file_path = path;
+	line_no = 0;
+	while (fgets(buf, sizeof(buf), f)) {
+		char *words[MAX_WORDS] = {NULL};
+		char *p, *end;
+		int count = 0;
+
+		line_no++;
+		if ((p = strchr(buf, '#'))) {
+			*p = 0;
+		}
+		/* trim, text is kept for stats output */
+		for (p = buf; isspace((unsigned char)*p); p++)
+			;
+		end = p + strlen(p);
+		while (end > p && isspace((unsigned char)end[-1])) {
+			*--end = 0;
+		}
+		if (!*p) {
+			continue;
+		}
+
+		if (sc->count == capacity) {
+			capacity = capacity ? capacity * 2 : 16;
+			sc->phases = realloc(sc->phases, capacity * sizeof(*sc->phases));
+			if (!sc->phases) {
+				perror("realloc");
+				abort();
+			}
+		}
+		memset(&sc->phases[sc->count], 0, sizeof(sc->phases[0]));
+		sc->phases[sc->count].text = strdup(p);
+
+		for (char *w = strtok(p, " \t"); w; w = strtok(NULL, " \t")) {
+			if (count == MAX_WORDS) {
+				syntax_error("too many words");
+			}
+			words[count++] = w;
+		}
+		parse_phase(&sc->phases[sc->count], words, count);
+		sc->count++;
+	}
+	fclose(f);
+	if (!sc->count) {
+		fprintf(stderr, "%s: no phases\n", path);
+		exit(1);
+	}
+	return sc;
+}
@@ -0,0 +1,66 @@
+#ifndef SCENARIO_H
+#define SCENARIO_H
+#include "size-dist.h"
+
+/*
+ * Scenario file describes random workload as sequence of phases, one
+ * per line. '#' starts comment. Phases are:
+ *
+ *   fill <mb>                  allocate until <mb> is allocated
+ *   churn <iterations> <rate>  every iteration free <rate> per mille
+ *                              of blobs and fill back
+ *   grow <factor>              raise fill target by factor and fill
+ *   shrink <factor>            lower fill target by factor, freeing
+ *                              random blobs
+ *   sizes uniform <min> <range>
+ *   sizes histo <file>... [mix <iterations>]
+ *                              switch size distribution of new
+ *                              allocations (see -D and -M)
+ *   free <percent>             free that percentage of blobs at random
+ *   bump                       grow smaller half of blobs by 1/256
+ *   replay <trace> [<skip> <count>]
+ *                              replay (segment of) trace. Keys of
+ *                              trace share slots with random blobs
+ *
+ * Stats are printed after every phase.
+ */
+
+enum scenario_phase_type {
+	PHASE_FILL,
+	PHASE_CHURN,
+	PHASE_GROW,
+	PHASE_SHRINK,
+	PHASE_SIZES_UNIFORM,
+	PHASE_SIZES_HISTO,
+	PHASE_FREE,
+	PHASE_BUMP,
+	PHASE_REPLAY
+};
+
+struct scenario_phase {
+	enum scenario_phase_type type;
+	/* text of line, for stats output */
+	char *text;
+	/* mb, factor or percent */
+	double value;
+	/* churn: iterations and rate. replay: skip and count. sizes
+	 * uniform: min and range */
+	unsigned long a;
+	unsigned long b;
+	/* histo */
+	struct size_dist *dists[MAX_SIZE_DISTS];
+	int dists_count;
+	int mix_period;
+	/* replay */
+	char *path;
+};
+
+struct scenario {
+	struct scenario_phase *phases;
+	int count;
+};
+
+/* exits with message on syntax errors */
+extern struct scenario *scenario_load(const char *path);
+
+#endif
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "size-dist.h"
+
+static
+void *xmalloc(size_t size)
+{
+	void *rv = malloc(size);
+	if (!rv) {
+		perror("malloc");
+		abort();
+	}
+	return rv;
+}
+
+struct size_dist *size_dist_load(const char *path)
+{
+	struct size_dist *d = xmalloc(sizeof(*d));
+	size_t capacity = 256;
+	unsigned long *counts = xmalloc(capacity * sizeof(*counts));
+	uint32_t *sizes = xmalloc(capacity * sizeof(*sizes));
+	int lines = 0;
+	double total = 0, sum = 0;
+	char buf[256];
+	FILE *f;
+	int *small, *large;
+	int small_count = 0, large_count = 0;
+	double *scaled;
+	int k, n;
+
+	f = fopen(path, "r");
+	if (!f) {
+		perror("fopen");
+		abort();
+	}
+	while (fgets(buf, sizeof(buf), f)) {
+		unsigned size;
+		unsigned long count;
+		if (buf[0] == '#' || sscanf(buf, "%u %lu", &size, &count) != 2) {
+			continue;
+		}
+		if (lines && size <= sizes[lines - 1]) {
+			fprintf(stderr, "%s: sizes must be increasing (%u)\n", path, size);
+			abort();
+		}
+		if (lines == capacity) {
+			capacity *= 2;
+			counts = realloc(counts, capacity * sizeof(*counts));
+			sizes = realloc(sizes, capacity * sizeof(*sizes));
+			if (!counts || !sizes) {
+				perror("realloc");
+				abort();
+			}
+		}
+		sizes[lines] = size;
+		counts[lines] = count;
+		lines++;
+	}
+	fclose(f);
+
+	d->path = path;
+	d->count = 0;
+	d->base = xmalloc(lines * sizeof(*d->base));
+	d->width = xmalloc(lines * sizeof(*d->width));
+	d->keep = xmalloc(lines * sizeof(*d->keep));
+	d->alias = xmalloc(lines * sizeof(*d->alias));
+	scaled = xmalloc(lines * sizeof(*scaled));
+	small = xmalloc(lines * sizeof(*small));
+	large = xmalloc(lines * sizeof(*large));
+
+	/* only non-empty buckets go into table. Last bucket is as wide
+	 * as one before it */
+	for (k = 0; k < lines; k++) {
+		unsigned width;
+		if (k + 1 < lines) {
+			width = sizes[k + 1] - sizes[k];
+		} else {
+			width = k ? sizes[k] - sizes[k - 1] : 1;
+		}
+		if (!counts[k]) {
+			continue;
+		}
+		d->base[d->count] = sizes[k];
+		d->width[d->count] = width;
+		scaled[d->count] = counts[k];
+		d->count++;
+		total += counts[k];
+		sum += counts[k] * (sizes[k] + (width - 1) / 2.0);
+	}
+	if (!d->count) {
+		fprintf(stderr, "%s: empty histogram\n", path);
+		abort();
+	}
+	d->mean = sum / total;
+	n = d->count;
+
+	for (k = 0; k < n; k++) {
+		scaled[k] = scaled[k] * n / total;
+		if (scaled[k] < 1) {
+			small[small_count++] = k;
+		} else {
+			large[large_count++] = k;
+		}
+	}
+	while (small_count && large_count) {
+		int s = small[--small_count];
+		int l = large[--large_count];
+		d->keep[s] = scaled[s] * (1U << 31);
+		d->alias[s] = l;
+		scaled[l] -= 1 - scaled[s];
+		if (scaled[l] < 1) {
+			small[small_count++] = l;
+		} else {
+			large[large_count++] = l;
+		}
+	}
+	/* leftovers are 1 up to rounding errors */
+	while (large_count) {
+		k = large[--large_count];
+		d->keep[k] = 1U << 31;
+		d->alias[k] = k;
+	}
+	while (small_count) {
+		k = small[--small_count];
+		d->keep[k] = 1U << 31;
+		d->alias[k] = k;
+	}
+
+	free(scaled);
+	free(small);
+	free(large);
+	free(counts);
+	free(sizes);
+	return d;
+}
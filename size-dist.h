@@ -0,0 +1,42 @@
+#ifndef SIZE_DIST_H
+#define SIZE_DIST_H
+#include <stdint.h>
+
+/* how many distributions can be mixed */
+#define MAX_SIZE_DISTS 16
+
+/*
+ * Empirical size distribution, loaded from histogram file of "size
+ * count" lines (like sample_sr_data_histo.txt, '#' starts comment).
+ * Each line is bucket [size, next size) and sizes are sampled
+ * uniformly inside bucket. Buckets are picked in O(1) via Vose's
+ * alias table.
+ */
+struct size_dist {
+	const char *path;
+	int count;
+	uint32_t *base;
+	uint32_t *width;
+	/* probability of keeping bucket, scaled to 2^31 */
+	uint32_t *keep;
+	int *alias;
+	double mean;
+};
+
+extern struct size_dist *size_dist_load(const char *path);
+
+/* r1 and r2 are independent 31 bit random numbers, i.e. from
+ * random() */
+static inline
+unsigned size_dist_sample(const struct size_dist *d, uint32_t r1, uint32_t r2)
+{
+	unsigned idx = r1 % d->count;
+	unsigned size;
+	if (r2 >= d->keep[idx]) {
+		idx = d->alias[idx];
+	}
+	size = d->base[idx] + (r1 / d->count) % d->width[idx];
+	return size ? size : 1;
+}
+
+#endif
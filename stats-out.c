@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "stats-out.h"
+
+#define RECORD_MAX 2048
+
+static int out_fd = -1;
+static bool json;
+
+static const char *const field_names[] = {
+	"schema", "time_s", "phase", "allocator", "minimal_size", "size_range",
+	"footprint", "live_bytes", "live_count", "waste_pct", "max_waste_pct",
+	"ops", "ops_per_sec", "minflt", "majflt", "rss", "pss",
+	"alloc_p50_ns", "alloc_p99_ns", "alloc_p999_ns", "alloc_max_ns",
+	"free_p50_ns", "free_p99_ns", "free_p999_ns", "free_max_ns",
+	"cycles_per_op", "instructions_per_op", "cache_misses_per_op",
+	"dtlb_misses_per_op", "page_faults_per_op"
+};
+
+struct record_buf {
+	char data[RECORD_MAX];
+	size_t pos;
+	int field;
+};
+
+static __attribute__((format(printf, 2, 3)))
+void append(struct record_buf *b, const char *fmt, ...)
+{
+	va_list ap;
+	int rv;
+	va_start(ap, fmt);
+	rv = vsnprintf(b->data + b->pos, sizeof(b->data) - b->pos, fmt, ap);
+	va_end(ap);
+	if (rv > 0) {
+		b->pos += rv;
+		if (b->pos >= sizeof(b->data)) {
+			b->pos = sizeof(b->data) - 1;
+		}
+	}
+}
+
+static
+void begin_field(struct record_buf *b)
+{
+	if (json) {
+		append(b, "%s\"%s\":", b->field ? "," : "{", field_names[b->field]);
+	} else if (b->field) {
+		append(b, ",");
+	}
+	b->field++;
+}
+
+static
+void put_null(struct record_buf *b)
+{
+	begin_field(b);
+	if (json) {
+		append(b, "null");
+	}
+}
+
+/* long strings are cut, so that record always fits */
+#define STRING_MAX 256
+
+static
+void put_string(struct record_buf *b, const char *s)
+{
+	const char *end = s + strnlen(s, STRING_MAX);
+	begin_field(b);
+	append(b, "\"");
+	for (; s < end; s++) {
+		if (*s == '"') {
+			append(b, json ? "\\\"" : "\"\"");
+		} else if (json && *s == '\\') {
+			append(b, "\\\\");
+		} else if (json && (unsigned char)*s < 0x20) {
+			append(b, "\\u%04x", *s);
+		} else {
+			append(b, "%c", *s);
+		}
+	}
+	append(b, "\"");
+}
+
+static
+void put_ulong(struct record_buf *b, unsigned long v)
+{
+	begin_field(b);
+	append(b, "%lu", v);
+}
+
+static
+void put_long(struct record_buf *b, long v)
+{
+	begin_field(b);
+	append(b, "%ld", v);
+}
+
+static
+void put_double(struct record_buf *b, double v)
+{
+	begin_field(b);
+	append(b, "%.6g", v);
+}
+
+/* compares first line of existing CSV file with header */
+static
+bool same_header(const char *header, size_t len)
+{
+	char buf[RECORD_MAX];
+	ssize_t rv = pread(out_fd, buf, len, 0);
+	return rv == (ssize_t)len && memcmp(buf, header, len) == 0;
+}
+
+bool stats_out_open(const char *spec)
+{
+	const char *path;
+	struct stat st;
+
+	if (strncmp(spec, "csv:", 4) == 0) {
+		json = false;
+	} else if (strncmp(spec, "json:", 5) == 0) {
+		json = true;
+	} else {
+		return false;
+	}
+	path = strchr(spec, ':') + 1;
+	if (!*path) {
+		return false;
+	}
+
+	out_fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (out_fd < 0) {
+		perror("open");
+		abort();
+	}
+	if (fstat(out_fd, &st)) {
+		perror("fstat");
+		abort();
+	}
+	if (!json) {
+		struct record_buf b = {.pos = 0};
+		for (size_t k = 0; k < sizeof(field_names) / sizeof(field_names[0]); k++) {
+			append(&b, "%s%s", k ? "," : "", field_names[k]);
+		}
+		append(&b, "\n");
+		if (st.st_size == 0) {
+			if (write(out_fd, b.data, b.pos) != b.pos) {
+				perror("write");
+				abort();
+			}
+		} else if (!same_header(b.data, b.pos)) {
+			/* rows wouldn't match columns. JSON lines carry
+			 * their schema, so they can be mixed */
+			fprintf(stderr, "%s has header of other schema version than %d, "
+				"use new file\n", path, STATS_SCHEMA_VERSION);
+			exit(1);
+		}
+	}
+	return true;
+}
+
+bool stats_out_enabled(void)
+{
+	return out_fd >= 0;
+}
+
+void stats_out_write(const struct stats_record *r)
+{
+	struct record_buf b = {.pos = 0, .field = 0};
+	int op, k;
+
+	put_ulong(&b, STATS_SCHEMA_VERSION);
+	put_double(&b, r->time);
+	put_string(&b, r->phase);
+	put_string(&b, r->allocator);
+	put_long(&b, r->minimal_size);
+	put_long(&b, r->size_range);
+	put_ulong(&b, r->footprint);
+	put_ulong(&b, r->live_bytes);
+	put_long(&b, r->live_count);
+	put_double(&b, r->waste);
+	put_double(&b, r->max_waste);
+	put_ulong(&b, r->ops);
+	if (r->ops_per_sec >= 0) {
+		put_double(&b, r->ops_per_sec);
+	} else {
+		put_null(&b);
+	}
+	put_long(&b, r->minflt);
+	put_long(&b, r->majflt);
+	put_ulong(&b, r->rss);
+	if (r->pss) {
+		put_ulong(&b, r->pss);
+	} else {
+		put_null(&b);
+	}
+	for (op = 0; op < 2; op++) {
+		for (k = 0; k < 4; k++) {
+			if (r->has_latency[op]) {
+				put_double(&b, r->latency[op][k]);
+			} else {
+				put_null(&b);
+			}
+		}
+	}
+	for (k = 0; k < 5; k++) {
+		if (r->has_perf[k]) {
+			put_double(&b, r->perf[k]);
+		} else {
+			put_null(&b);
+		}
+	}
+	append(&b, json ? "}\n" : "\n");
+
+	if (write(out_fd, b.data, b.pos) != b.pos) {
+		perror("write");
+		abort();
+	}
+}
@@ -0,0 +1,54 @@
+#ifndef STATS_OUT_H
+#define STATS_OUT_H
+#include <stdbool.h>
+#include <sys/types.h>
+
+/*
+ * Machine readable stats. Every print_current_stats() appends one
+ * record to file, either as CSV row (header is written when file is
+ * empty) or as JSON object per line. Fields and their order are
+ * stable; new fields are only ever appended, together with bump of
+ * STATS_SCHEMA_VERSION. Fields that don't apply are empty in CSV
+ * and null in JSON. Existing CSV file is only appended to if it's
+ * header matches current schema.
+ *
+ * Every record is single O_APPEND write, so that sweep children can
+ * share one file.
+ */
+
+#define STATS_SCHEMA_VERSION 2
+
+struct stats_record {
+	double time;
+	const char *phase;
+	const char *allocator;
+	int minimal_size;
+	int size_range;
+	size_t footprint;
+	size_t live_bytes;
+	long live_count;
+	double waste;
+	double max_waste;
+	unsigned long ops;
+	/* < 0 if n/a */
+	double ops_per_sec;
+	long minflt;
+	long majflt;
+	size_t rss;
+	/* 0 if n/a */
+	size_t pss;
+	/* alloc and free, p50, p99, p99.9 and max in ns */
+	bool has_latency[2];
+	double latency[2][4];
+	/* cycles, instructions, cache misses, dTLB misses and page
+	 * faults per op (see perf-counters.h) */
+	bool has_perf[5];
+	double perf[5];
+};
+
+/* spec is csv:path or json:path. false if it is invalid */
+extern bool stats_out_open(const char *spec);
+extern bool stats_out_enabled(void);
+extern void stats_out_write(const struct stats_record *r);
+
+#endif
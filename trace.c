@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "trace.h"
+
+/* consumed part of reader's mapping is dropped every that many
+ * bytes, so that page cache of big traces doesn't count as our
+ * rss */
+#define READER_DROP_BYTES (64 << 20)
+
+#define WRITER_BUF_SIZE (1 << 16)
+
+struct trace_writer {
+	FILE *f;
+	struct trace_codec codec;
+	size_t pos;
+	unsigned char buf[WRITER_BUF_SIZE];
+};
+
+struct trace_reader {
+	struct trace_codec codec;
+	unsigned char *map;
+	size_t size;
+	size_t offset;
+	size_t dropped;
+	/* end of current chunk, or of whole file if not chunked */
+	size_t end;
+};
+
+static inline
+unsigned char *put_varint(unsigned char *p, uint64_t v)
+{
+	while (v >= 0x80) {
+		*p++ = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+/* returns NULL if varint is truncated or too long */
+static inline
+const unsigned char *get_varint(const unsigned char *p, const unsigned char *end, uint64_t *v)
+{
+	uint64_t rv = 0;
+	for (unsigned shift = 0; shift < 64; shift += 7) {
+		if (p >= end) {
+			return NULL;
+		}
+		rv |= (uint64_t)(*p & 0x7f) << shift;
+		if (!(*p++ & 0x80)) {
+			*v = rv;
+			return p;
+		}
+	}
+	return NULL;
+}
+
+static inline
+uint64_t zigzag(int64_t v)
+{
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline
+int64_t unzigzag(uint64_t v)
+{
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+size_t trace_encode(struct trace_codec *c, const struct trace_event *e,
+		    unsigned char *out)
+{
+	unsigned char *p = out;
+	*p++ = e->type;
+	p = put_varint(p, zigzag((int64_t)(e->key - c->prev_key)));
+	c->prev_key = e->key;
+	if (e->type != TRACE_FREE) {
+		p = put_varint(p, e->len);
+	}
+	if (c->flags & TRACE_F_TIMESTAMPS) {
+		p = put_varint(p, e->timestamp - c->prev_timestamp);
+		c->prev_timestamp = e->timestamp;
+	}
+	if (c->flags & TRACE_F_THREADS) {
+		p = put_varint(p, e->thread);
+	}
+	return p - out;
+}
+
+ssize_t trace_decode(struct trace_codec *c, const unsigned char *p,
+		     const unsigned char *end, struct trace_event *e)
+{
+	const unsigned char *start = p;
+	uint64_t v;
+
+	if (p >= end) {
+		return 0;
+	}
+	if (*p > TRACE_REALLOC) {
+		return -1;
+	}
+	e->type = *p++;
+
+	if (!(p = get_varint(p, end, &v))) {
+		goto truncated;
+	}
+	e->key = c->prev_key + unzigzag(v);
+
+	e->len = 0;
+	if (e->type != TRACE_FREE && !(p = get_varint(p, end, &e->len))) {
+		goto truncated;
+	}
+
+	e->timestamp = c->prev_timestamp;
+	if (c->flags & TRACE_F_TIMESTAMPS) {
+		if (!(p = get_varint(p, end, &v))) {
+			goto truncated;
+		}
+		e->timestamp += v;
+	}
+
+	e->thread = 0;
+	if (c->flags & TRACE_F_THREADS) {
+		if (!(p = get_varint(p, end, &v))) {
+			goto truncated;
+		}
+		e->thread = v;
+	}
+
+	c->prev_key = e->key;
+	c->prev_timestamp = e->timestamp;
+	return p - start;
+
+truncated:
+	/* overlong varint is corruption, running out of bytes isn't */
+	return end - start >= TRACE_MAX_EVENT_BYTES ? -1 : 0;
+}
+
+void trace_header_init(struct trace_header *h, unsigned flags)
+{
+	memset(h, 0, sizeof(*h));
+	memcpy(h->magic, TRACE_MAGIC, sizeof(h->magic));
+	h->version = TRACE_VERSION;
+	h->flags = flags;
+}
+
+static
+void writer_flush(struct trace_writer *w)
+{
+	if (w->pos && fwrite(w->buf, w->pos, 1, w->f) != 1) {
+		perror("fwrite");
+		abort();
+	}
+	w->pos = 0;
+}
+
+struct trace_writer *trace_writer_open(const char *path, unsigned flags)
+{
+	struct trace_writer *w = calloc(1, sizeof(*w));
+	struct trace_header h;
+	if (!w) {
+		perror("calloc");
+		abort();
+	}
+	w->f = fopen(path, "wb");
+	if (!w->f) {
+		perror("fopen");
+		abort();
+	}
+	w->codec.flags = flags;
+	trace_header_init(&h, flags);
+	if (fwrite(&h, sizeof(h), 1, w->f) != 1) {
+		perror("fwrite");
+		abort();
+	}
+	return w;
+}
+
+void trace_write(struct trace_writer *w, const struct trace_event *e)
+{
+	if (w->pos + TRACE_MAX_EVENT_BYTES > WRITER_BUF_SIZE) {
+		writer_flush(w);
+	}
+	w->pos += trace_encode(&w->codec, e, w->buf + w->pos);
+}
+
+void trace_writer_close(struct trace_writer *w)
+{
+	writer_flush(w);
+	if (fclose(w->f)) {
+		perror("fclose");
+		abort();
+	}
+	free(w);
+}
+
+struct trace_reader *trace_reader_open(const char *path)
+{
+	struct trace_reader *r;
+	struct trace_header h;
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror("open");
+		abort();
+	}
+	if (fstat(fd, &st)) {
+		perror("fstat");
+		abort();
+	}
+	if (st.st_size < sizeof(h)
+	    || pread(fd, &h, sizeof(h), 0) != sizeof(h)
+	    || memcmp(h.magic, TRACE_MAGIC, sizeof(h.magic)) != 0) {
+		close(fd);
+		return NULL;
+	}
+	if (h.version != TRACE_VERSION) {
+		fprintf(stderr, "%s: unsupported trace version %u\n", path, h.version);
+		abort();
+	}
+
+	r = calloc(1, sizeof(*r));
+	if (!r) {
+		perror("calloc");
+		abort();
+	}
+	r->codec.flags = h.flags;
+	r->size = st.st_size;
+	r->offset = sizeof(h);
+	r->end = (h.flags & TRACE_F_CHUNKED) ? r->offset : r->size;
+	r->map = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (r->map == MAP_FAILED) {
+		perror("mmap");
+		abort();
+	}
+	if (madvise(r->map, r->size, MADV_SEQUENTIAL)) {
+		perror("madvise");
+	}
+	close(fd);
+	return r;
+}
+
+unsigned trace_reader_flags(struct trace_reader *r)
+{
+	return r->codec.flags;
+}
+
+/* moves to next non-empty chunk. false at end of file */
+static
+bool next_chunk(struct trace_reader *r)
+{
+	while (r->offset == r->end) {
+		uint32_t len;
+		if (r->size - r->offset < sizeof(len)) {
+			return false;
+		}
+		memcpy(&len, r->map + r->offset, sizeof(len));
+		r->offset += sizeof(len);
+		r->end = r->offset + len;
+		if (r->end > r->size) {
+			fprintf(stderr, "ignoring truncated trace chunk at offset %zu\n",
+				r->offset - sizeof(len));
+			r->end = r->size;
+		}
+		trace_codec_reset(&r->codec);
+	}
+	return true;
+}
+
+bool trace_read(struct trace_reader *r, struct trace_event *e)
+{
+	ssize_t rv;
+	if ((r->codec.flags & TRACE_F_CHUNKED) && !next_chunk(r)) {
+		r->offset = r->size;
+		return false;
+	}
+	rv = trace_decode(&r->codec, r->map + r->offset, r->map + r->end, e);
+	if (rv < 0) {
+		fprintf(stderr, "corrupted trace event at offset %zu\n", r->offset);
+		abort();
+	}
+	if (rv == 0) {
+		if (r->offset != r->size) {
+			fprintf(stderr, "ignoring truncated trace event at offset %zu\n", r->offset);
+			r->offset = r->end = r->size;
+		}
+		return false;
+	}
+	r->offset += rv;
+
+	if (r->offset - r->dropped >= READER_DROP_BYTES) {
+		size_t upto = r->offset & ~((size_t)getpagesize() - 1);
+		madvise(r->map + r->dropped, upto - r->dropped, MADV_DONTNEED);
+		r->dropped = upto;
+	}
+	return true;
+}
+
+void trace_reader_close(struct trace_reader *r)
+{
+	munmap(r->map, r->size);
+	free(r);
+}
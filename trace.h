@@ -0,0 +1,106 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/*
+ * Trace format v2. File starts with struct trace_header, followed by
+ * stream of variable length events:
+ *
+ *   tag byte: event type in low 2 bits, rest must be zero
+ *   key: zigzag varint of difference with previous event's key
+ *   len: varint, only for alloc and realloc
+ *   timestamp: varint of difference with previous one, in ns, only
+ *     if TRACE_F_TIMESTAMPS
+ *   thread: varint, only if TRACE_F_THREADS
+ *
+ * Varints are LEB128 (7 bits per byte, little endian). Header
+ * fields and chunk lengths are in host byte order (header is written
+ * as is), so traces are only portable between same endian hosts.
+ *
+ * Alloc of key that is still live implicitly frees it first, like
+ * in simple_dump. Realloc changes size of live key (or allocates it
+ * if it isn't live).
+ *
+ * With TRACE_F_CHUNKED, events come in chunks, each prefixed by
+ * uint32 byte length. Delta state is reset at start of every chunk,
+ * so independent writers (i.e. threads) can append whole chunks.
+ *
+ * With TRACE_F_ADDRESSES, keys are addresses of recorded process,
+ * rather than small slot numbers, and have to be mapped into slots
+ * by replay.
+ */
+
+#define TRACE_MAGIC "BXTR"
+#define TRACE_VERSION 2
+
+#define TRACE_F_TIMESTAMPS 1
+#define TRACE_F_THREADS 2
+#define TRACE_F_CHUNKED 4
+#define TRACE_F_ADDRESSES 8
+
+/* upper bound of encoded size of single event */
+#define TRACE_MAX_EVENT_BYTES 40
+
+enum trace_event_type {
+	TRACE_ALLOC,
+	TRACE_FREE,
+	TRACE_REALLOC
+};
+
+struct trace_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t flags;
+	uint32_t reserved;
+};
+
+struct trace_event {
+	enum trace_event_type type;
+	uint64_t key;
+	uint64_t len;
+	uint64_t timestamp;
+	uint32_t thread;
+};
+
+/* delta state of single stream of events */
+struct trace_codec {
+	unsigned flags;
+	uint64_t prev_key;
+	uint64_t prev_timestamp;
+};
+
+static inline
+void trace_codec_reset(struct trace_codec *c)
+{
+	c->prev_key = 0;
+	c->prev_timestamp = 0;
+}
+
+/* encodes event into out, which must have TRACE_MAX_EVENT_BYTES of
+ * space. Returns number of bytes written */
+extern size_t trace_encode(struct trace_codec *c, const struct trace_event *e,
+			   unsigned char *out);
+/* returns number of bytes consumed, 0 if event is truncated (end
+ * reached) and -1 if it is malformed */
+extern ssize_t trace_decode(struct trace_codec *c, const unsigned char *p,
+			    const unsigned char *end, struct trace_event *e);
+
+extern void trace_header_init(struct trace_header *h, unsigned flags);
+
+struct trace_writer;
+struct trace_reader;
+
+extern struct trace_writer *trace_writer_open(const char *path, unsigned flags);
+extern void trace_write(struct trace_writer *w, const struct trace_event *e);
+extern void trace_writer_close(struct trace_writer *w);
+
+/* returns NULL if file isn't v2 trace */
+extern struct trace_reader *trace_reader_open(const char *path);
+extern unsigned trace_reader_flags(struct trace_reader *r);
+/* false at end of trace */
+extern bool trace_read(struct trace_reader *r, struct trace_event *e);
+extern void trace_reader_close(struct trace_reader *r);
+
+#endif